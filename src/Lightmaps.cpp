@@ -41,6 +41,7 @@
 
 #include "Lightmaps.h"
 #include <QApplication>
+#include <math.h>
 
 LightMaps::LightMaps(QWidget *parent) :
     QWidget(parent),
@@ -50,9 +51,14 @@ LightMaps::LightMaps(QWidget *parent) :
     m_Copyright("Map data CCbySA 2009 OpenStreetMap.org contributors")
 
 {
+    // everything is painted from the backing pixmap.
+    setAttribute(Qt::WA_OpaquePaintEvent);
+
     m_Map = new SlippyMap(this);
     connect(m_Map, SIGNAL(updated(QRect)), SLOT(updateMap(QRect)));
     connect(m_Map, SIGNAL(updated(QRect)), this, SIGNAL(updated()));
+    connect(m_Map, SIGNAL(scrolled(QPoint)), SLOT(scrollMap(QPoint)));
+    connect(m_Map, SIGNAL(scrolled(QPoint)), this, SIGNAL(updated()));
 }
 
 void LightMaps::setCenter(qreal lat, qreal lng)
@@ -124,22 +130,68 @@ qreal LightMaps::longitude() const
 
 void LightMaps::updateMap(const QRect &r)
 {
+    m_Dirty += r;
     update(r);
 }
-void LightMaps::resizeEvent(QResizeEvent *)
+
+// Panning moves what we already rendered in the backing pixmap and
+// only marks the strips that scrolled into view as dirty.
+void LightMaps::scrollMap(const QPoint &delta)
 {
-    m_Map->width = width();
-    m_Map->height = height();
-    m_Map->invalidate();
+    if ( delta.isNull() )
+    {
+        return;
+    }
+
+    qreal dpr = m_Backing.devicePixelRatio();
+
+    if ( m_Backing.isNull() || dpr != floor(dpr) )
+    {
+        invalidateBacking();
+        return;
+    }
+
+    m_Backing.scroll(delta.x() * dpr, delta.y() * dpr, m_Backing.rect());
+
+    m_Dirty.translate(delta);
+    m_Dirty += QRegion(rect()) - QRegion(rect().translated(delta));
+    update();
 }
 
-void LightMaps::paintEvent(QPaintEvent *event)
+void LightMaps::invalidateBacking()
 {
-    QPainter p;    
-    p.begin(this);
+    m_Dirty = rect();
+    update();
+}
+
+// brings the dirty parts of the backing pixmap up to date, map tiles and track.
+void LightMaps::renderBacking()
+{
+    qreal dpr = devicePixelRatio();
+    QSize size = this->size() * dpr;
+
+    if ( m_Backing.size() != size )
+    {
+        m_Backing = QPixmap(size);
+        m_Backing.setDevicePixelRatio(dpr);
+        m_Dirty = rect();
+    }
+
+    m_Dirty &= rect();
+
+    if ( m_Dirty.isEmpty() )
+    {
+        return;
+    }
+
+    QPainter p;
+    p.begin(&m_Backing);
     p.setRenderHint(QPainter::Antialiasing);
+    p.setClipRegion(m_Dirty);
 
-    m_Map->render(&p, event->rect());
+    QRect dirtyRect = m_Dirty.boundingRect();
+    p.fillRect(dirtyRect, palette().window());
+    m_Map->render(&p, dirtyRect);
 
     QPen pen;
     pen.setColor(Qt::red);
@@ -166,11 +218,37 @@ void LightMaps::paintEvent(QPaintEvent *event)
             continue;
         }
 
+        if ( !dirtyRect.intersects( QRect(p1, p2).normalized().adjusted(-3, -3, 3, 3)) )
+        {
+            continue;
+        }
+
         p.drawLine(p1,p2);
 
 
     }
 
+    p.end();
+
+    m_Dirty = QRegion();
+}
+
+void LightMaps::resizeEvent(QResizeEvent *)
+{
+    m_Map->width = width();
+    m_Map->height = height();
+    m_Map->invalidate();
+}
+
+void LightMaps::paintEvent(QPaintEvent *)
+{
+    renderBacking();
+
+    QPainter p;    
+    p.begin(this);
+    p.drawPixmap(0, 0, m_Backing);
+    p.setRenderHint(QPainter::Antialiasing);
+
     QPen pen_blue;
     pen_blue.setColor(Qt::blue);
     pen_blue.setWidth(3);
@@ -327,12 +405,14 @@ QRectF LightMaps::geoBounds()
 void LightMaps::clearLines()
 {
     m_Lines.clear();
+    invalidateBacking();
 }
 
 void LightMaps::addLine(qreal latitude1, qreal longitude1, qreal latitude2, qreal longitude2)
 {
     QRectF line( QPointF(longitude1, latitude1),QPointF(longitude2, latitude2) );
     m_Lines.append(line);
+    invalidateBacking();
 }
 
 void LightMaps::clearCircles()
@@ -85,6 +85,7 @@ public:
 
 private slots:
     void updateMap(const QRect &r);
+    void scrollMap(const QPoint &delta);
 
 
 protected:
@@ -107,7 +108,12 @@ signals:
     void dragBegin();
 
 private:
+    void invalidateBacking();
+    void renderBacking();
+
     SlippyMap *m_Map;
+    QPixmap m_Backing;
+    QRegion m_Dirty;
     bool m_Pressed;
     bool m_Snapped;
     bool m_Dragging;
@@ -44,18 +44,12 @@
 
 #include <QApplication>
 #include <math.h>
+#include <algorithm>
 
 
 // tile size in pixels
 static const int tdim = 256;
 
-// hash for caching the tiles
-static unsigned int qHash(const QPoint& p)
-{
-    return p.x() * 17 ^ p.y();
-}
-
-
 // Mercator projection calculations.
 static QPointF tileForCoordinate(qreal lat, qreal lng, int zoom)
 {
@@ -81,16 +75,22 @@ static qreal latitudeFromTile(qreal ty, int zoom)
     return lng;
 }
 
-// not quite a spirallist. TODO make it one.
-static void reverseSpiralList ( int start, int end, int startY, int h, QList<QPoint> &list)
+// all tiles in the grid, ordered centre first.
+static void spiralList ( const QRect & tiles, const QPointF & center, QList<QPoint> &list)
 {
-    for (int y=startY;y < (startY + h); y++)
+    for (int y=tiles.top();y <= tiles.bottom() + 1; y++)
     {
-        for (int x=start;x<=end;x++)
+        for (int x=tiles.left();x<=tiles.right() + 1;x++)
         {
-             list.insert(0, QPoint(x,y));
+             list.append(QPoint(x,y));
         }
     }
+
+    std::stable_sort(list.begin(), list.end(), [&center](const QPoint & a, const QPoint & b) {
+        QPointF da = QPointF(a) + QPointF(0.5, 0.5) - center;
+        QPointF db = QPointF(b) + QPointF(0.5, 0.5) - center;
+        return QPointF::dotProduct(da, da) < QPointF::dotProduct(db, db);
+    });
 }
 
 
@@ -147,6 +147,17 @@ void SlippyMap::invalidate()
         return;
     }
 
+    layoutTiles();
+    updateTileList();
+
+    download();
+
+    emit updated(QRect(0, 0, width, height));
+}
+
+// works out which tiles are visible and where the top-left one goes.
+void SlippyMap::layoutTiles()
+{
     m_CenterPoint = tileForCoordinate(latitude, longitude, zoom);
 
     qreal tx = m_CenterPoint.x();
@@ -172,29 +183,18 @@ void SlippyMap::invalidate()
 
     // build a rect
     m_tilesRect = QRect(xs, ys, xe - xs + 1, ye - ys + 1);
-    m_TileList.clear();
-    reverseSpiralList(0, m_tilesRect.width(), 0, m_tilesRect.height(), m_TileList);
-
-    for ( int i=0; i <  m_TileList.length(); i++ )
-    {
-        m_TileList[i] = m_tilesRect.topLeft() + m_TileList[i];
-    }
-
-    // now move the center tile to the beginning just to be sure.
-    QPoint center( static_cast<int>(tx),static_cast<int>(ty) );
-
-    for ( int i=0; i <  m_TileList.length(); i++ )
-    {
-        if ( m_TileList[i] == center )
-        {
-            m_TileList.move(i,0);
-            break;
-        }
-    }
+}
 
-    download();
+void SlippyMap::updateTileList()
+{
+    m_TileList.clear();
+    spiralList(m_tilesRect, m_CenterPoint, m_TileList);
 
-    emit updated(QRect(0, 0, width, height));
+    // tiles that would otherwise show up empty go first, the ones we can
+    // already fill in from a neighbouring zoom level follow. Both centre first.
+    std::stable_sort(m_TileList.begin(), m_TileList.end(), [this](const QPoint & a, const QPoint & b) {
+        return !hasFallback(a) && hasFallback(b);
+    });
 }
 
 void SlippyMap::render(QPainter *p, const QRect &rect)
@@ -207,11 +207,12 @@ void SlippyMap::render(QPainter *p, const QRect &rect)
             QRect box = tileRect(tp);
             if (rect.intersects(box))
             {
-                if (m_tilePixmaps.contains(tp))
+                TileKey key(zoom, tp);
+                if (m_tilePixmaps.contains(key))
                 {
-                    p->drawPixmap(box, m_tilePixmaps.value(tp));
+                    p->drawPixmap(box, m_tilePixmaps.value(key));
                 }
-                else
+                else if (!renderFallback(p, box, tp))
                 {
                     p->drawPixmap(box, m_emptyTile);
                 }
@@ -220,18 +221,131 @@ void SlippyMap::render(QPainter *p, const QRect &rect)
     }
 }
 
+// Draw a placeholder for a tile that is not loaded yet using the tiles
+// we still have in memory from the zoom level above or below.
+bool SlippyMap::renderFallback(QPainter *p, const QRect &box, const QPoint &tp)
+{
+    if ( tp.x() < 0 || tp.y() < 0 )
+    {
+        return false;
+    }
+
+    const int half = tdim / 2;
+
+    // scale up the quarter of the parent tile that covers this tile.
+    TileKey parent(zoom - 1, QPoint(tp.x() / 2, tp.y() / 2));
+    if ( zoom > 0 && m_tilePixmaps.contains(parent) )
+    {
+        QRect source((tp.x() & 1) * half, (tp.y() & 1) * half, half, half);
+        p->drawPixmap(box, m_tilePixmaps.value(parent), source);
+        return true;
+    }
+
+    // compose from the children that are available.
+    bool found = false;
+    for (int dy = 0; dy < 2; dy++)
+    {
+        for (int dx = 0; dx < 2; dx++)
+        {
+            TileKey child(zoom + 1, QPoint(tp.x() * 2 + dx, tp.y() * 2 + dy));
+            if ( !m_tilePixmaps.contains(child) )
+            {
+                continue;
+            }
+            if ( !found )
+            {
+                p->drawPixmap(box, m_emptyTile);
+                found = true;
+            }
+            p->drawPixmap(QRect(box.x() + dx * half, box.y() + dy * half, half, half), m_tilePixmaps.value(child));
+        }
+    }
+
+    return found;
+}
+
+bool SlippyMap::hasFallback(const QPoint &tp) const
+{
+    if ( tp.x() < 0 || tp.y() < 0 )
+    {
+        return false;
+    }
+
+    if ( zoom > 0 && m_tilePixmaps.contains(TileKey(zoom - 1, QPoint(tp.x() / 2, tp.y() / 2))) )
+    {
+        return true;
+    }
+
+    for (int dy = 0; dy < 2; dy++)
+    {
+        for (int dx = 0; dx < 2; dx++)
+        {
+            if ( m_tilePixmaps.contains(TileKey(zoom + 1, QPoint(tp.x() * 2 + dx, tp.y() * 2 + dy))) )
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// only keep tiles around the view, for the current zoom level and the
+// levels directly above and below it (used as placeholders).
+bool SlippyMap::keepTile(const TileKey &key) const
+{
+    QRect bound = m_tilesRect.adjusted(-5, -5, 5, 5);
+
+    switch ( key.zoom - zoom )
+    {
+    case -1:
+        return bound.contains(key.tile * 2);
+    case 0:
+        return bound.contains(key.tile);
+    case 1:
+        return bound.contains(QPoint(key.tile.x() / 2, key.tile.y() / 2));
+    default:
+        return false;
+    }
+}
+
 void SlippyMap::pan(const QPoint &delta)
 {    
     QPointF dx = QPointF(delta) / qreal(tdim);
     QPointF center = tileForCoordinate(latitude, longitude, zoom) - dx;
     latitude = latitudeFromTile(center.y(), zoom);
     longitude = longitudeFromTile(center.x(), zoom);    
-    invalidate();
 
+    if ( !locationSet || width <= 0 || height <= 0 )
+    {
+        return;
+    }
+
+    if ( m_tilesRect.isNull() )
+    {
+        invalidate();
+        return;
+    }
+
+    // track where a fixed tile ends up so the view can scroll exactly
+    // the amount render() would move it.
+    QRect oldTiles = m_tilesRect;
+    QPoint anchor = m_tilesRect.topLeft();
+    QPoint before = tileRect(anchor).topLeft();
+
+    layoutTiles();
+
+    // the tile list only changes when we cross a tile boundary.
+    if ( m_tilesRect != oldTiles )
+    {
+        updateTileList();
+        download();
+    }
+
+    emit scrolled(tileRect(anchor).topLeft() - before);
 }
 
 
-void SlippyMap::processTile(QPoint &tp, QByteArray &data)
+void SlippyMap::processTile(const TileKey &key, QByteArray &data)
 {
     QImage img;
     if (!img.loadFromData(data)) //(!img.load(reply, 0))
@@ -241,22 +355,23 @@ void SlippyMap::processTile(QPoint &tp, QByteArray &data)
     }
     else
     {
-        m_tilePixmaps[tp] = QPixmap::fromImage(img);
+        m_tilePixmaps[key] = QPixmap::fromImage(img);
         if (img.isNull())
         {
-            m_tilePixmaps[tp] = m_emptyTile;
+            m_tilePixmaps[key] = m_emptyTile;
         }
 
-        emit updated(tileRect(tp));
-
+        if ( key.zoom == zoom )
+        {
+            emit updated(tileRect(key.tile));
+        }
 
         // purge unused spaces
-        QRect bound = m_tilesRect.adjusted(-5, -5, 5, 5);
-        foreach(QPoint tp, m_tilePixmaps.keys())
+        foreach(const TileKey & k, m_tilePixmaps.keys())
         {
-            if (!bound.contains(tp))
+            if (!keepTile(k))
             {
-                m_tilePixmaps.remove(tp);
+                m_tilePixmaps.remove(k);
             }
         }
     }
@@ -267,6 +382,7 @@ void SlippyMap::handleNetworkData(QNetworkReply *reply)
     m_url = 0;
 
     QPoint tp = reply->request().attribute(QNetworkRequest::User).toPoint();
+    int tileZoom = reply->request().attribute((QNetworkRequest::Attribute)(QNetworkRequest::User + 1)).toInt();
     QUrl url = reply->url();    
 
     m_ActiveRequests.removeOne(reply);
@@ -274,7 +390,7 @@ void SlippyMap::handleNetworkData(QNetworkReply *reply)
     if (!reply->error())
     {        
         QByteArray data = reply->readAll();
-        processTile(tp, data);
+        processTile(TileKey(tileZoom, tp), data);
     }
     else
     {
@@ -301,7 +417,7 @@ void SlippyMap::download()
     QPoint grab(0, 0);
     for ( int i=0;i<m_TileList.length();i++)
     {
-        if (!m_tilePixmaps.contains( m_TileList[i] ))
+        if (!m_tilePixmaps.contains( TileKey(zoom, m_TileList[i]) ))
         {
             grab = m_TileList[i];
             if ( !download(grab) )
@@ -338,7 +454,7 @@ bool SlippyMap::download(QPoint grab)
         d->close();
         d->deleteLater();
 
-        processTile(grab, data);
+        processTile(TileKey(zoom, grab), data);
         m_url = 0;        
 
         return true;
@@ -349,6 +465,7 @@ bool SlippyMap::download(QPoint grab)
         request.setHeader(QNetworkRequest::UserAgentHeader, "Mozilla/5.0 (Windows NT 6.3; WOW64; rv:29.0) Gecko/20100101 Firefox/29.0");
         request.setUrl(m_url);
         request.setAttribute(QNetworkRequest::User, QVariant(grab));
+        request.setAttribute((QNetworkRequest::Attribute)(QNetworkRequest::User + 1), QVariant(zoom));
         // request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferCache);
         m_ActiveRequests.append ( m_manager.get(request) );
 
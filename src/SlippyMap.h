@@ -48,11 +48,27 @@
 #include <QtNetwork>
 #include <QNetworkAccessManager>
 
+// identifies a tile across zoom levels, so tiles of neighbouring
+// zoom levels can be used as placeholders.
+struct TileKey
+{
+    int zoom;
+    QPoint tile;
+
+    TileKey( int z = 0, const QPoint & tp = QPoint() ) : zoom(z), tile(tp) {}
+    bool operator==( const TileKey & other ) const { return zoom == other.zoom && tile == other.tile; }
+};
+
+inline uint qHash( const TileKey & key )
+{
+    return ( key.tile.x() * 17 ^ key.tile.y() ) ^ ( key.zoom << 26 );
+}
+
 class SlippyMap: public QObject
 {
     Q_OBJECT    
     QNetworkDiskCache * m_Cache;
-    void processTile(QPoint & tp, QByteArray & data );
+    void processTile(const TileKey & key, QByteArray & data );
 public:
     int width;
     int height;
@@ -84,16 +100,22 @@ private slots:
 
 signals:
     void updated(const QRect &rect);
+    void scrolled(const QPoint &delta);
 
 protected:
     QRect tileRect(const QPoint &tp);
+    void layoutTiles();
+    void updateTileList();
+    bool renderFallback(QPainter *p, const QRect &box, const QPoint &tp);
+    bool hasFallback(const QPoint &tp) const;
+    bool keepTile(const TileKey &key) const;
 
 private:
     QPoint m_offset;
     QRect m_tilesRect;
     QPointF m_CenterPoint;
     QPixmap m_emptyTile;
-    QHash<QPoint, QPixmap> m_tilePixmaps;
+    QHash<TileKey, QPixmap> m_tilePixmaps;
     QList<QPoint> m_TileList;
     QNetworkAccessManager m_manager;
     QList<QNetworkReply*> m_ActiveRequests;
@@ -50,5 +50,7 @@ private:
 
 typedef QSharedPointer<Activity>ActivityPtr;
 Q_DECLARE_METATYPE( ActivityPtr )
+typedef QList<ActivityPtr> ActivityList;
+Q_DECLARE_METATYPE( ActivityList )
 
 #endif // ACTIVITY_H
@@ -0,0 +1,102 @@
+#include "activitycache.h"
+#include "decodedactivity.h"
+
+#include <QFileInfo>
+#include <QDateTime>
+
+ActivityCache::ActivityCache(int budgetKB) :
+    m_Cache(budgetKB)
+{
+}
+
+int ActivityCache::cost(const ActivityCacheEntry *entry)
+{
+    // a track point is held through a shared pointer, count the control block too.
+    qint64 bytes = sizeof(Activity);
+    foreach ( LapPtr lap, entry->activity->laps() )
+    {
+        bytes += sizeof(Lap) + lap->points().count() * ( sizeof(TrackPoint) + 2 * sizeof(void*) + 16 );
+    }
+
+    bytes += ( entry->seconds.count() + entry->heartBeat.count() + entry->cadence.count() +
+               entry->speed.count() + entry->elevationSeries.count() ) * sizeof(double);
+
+    return qMax(1, int(bytes / 1024));
+}
+
+ActivityCacheEntry *ActivityCache::find(const QString &filename)
+{
+    ActivityCacheEntry * entry = m_Cache.object(filename);
+    if ( entry )
+    {
+        QFileInfo fi(filename);
+        if ( entry->size == fi.size() && entry->modified == fi.lastModified().toMSecsSinceEpoch() )
+        {
+            return entry;
+        }
+        m_Cache.remove(filename);
+    }
+
+    // not opened during this session, it may have been decoded before.
+    entry = new ActivityCacheEntry;
+    if ( !DecodedActivity::load(filename, *entry) )
+    {
+        delete entry;
+        return 0;
+    }
+
+    if ( !m_Cache.insert(filename, entry, cost(entry)) )
+    {
+        return 0;
+    }
+    return entry;
+}
+
+ActivityCacheEntry *ActivityCache::peek(const QString &filename)
+{
+    return m_Cache.object(filename);
+}
+
+ActivityCacheEntry *ActivityCache::insert(const QString &filename, ActivityPtr activity)
+{
+    QFileInfo fi(filename);
+
+    ActivityCacheEntry * entry = new ActivityCacheEntry;
+    entry->activity = activity;
+    entry->size = fi.size();
+    entry->modified = fi.lastModified().toMSecsSinceEpoch();
+
+    // QCache deletes the entry right away when it is over budget on its own.
+    if ( !m_Cache.insert(filename, entry, cost(entry)) )
+    {
+        return 0;
+    }
+    return entry;
+}
+
+void ActivityCache::update(const QString &filename)
+{
+    // the cost of an entry can only be changed by inserting it again.
+    ActivityCacheEntry * entry = m_Cache.take(filename);
+    if ( !entry )
+    {
+        return;
+    }
+
+    // only complete workouts are persisted, without elevation it is retried on the next open.
+    if ( entry->hasSeries && entry->elevation )
+    {
+        DecodedActivity::save(filename, *entry);
+    }
+    m_Cache.insert(filename, entry, cost(entry));
+}
+
+void ActivityCache::remove(const QString &filename)
+{
+    m_Cache.remove(filename);
+}
+
+void ActivityCache::clear()
+{
+    m_Cache.clear();
+}
@@ -0,0 +1,48 @@
+#ifndef ACTIVITYCACHE_H
+#define ACTIVITYCACHE_H
+
+#include <QString>
+#include <QVector>
+#include <QCache>
+#include "activity.h"
+
+// A parsed workout and the graph series derived from it.
+struct ActivityCacheEntry
+{
+    ActivityPtr activity;
+    qint64 size;        // identity of the .ttbin file the activity was read from
+    qint64 modified;
+    bool hasSeries;     // the series below are filled in
+    bool elevation;     // elevation data was loaded into the activity
+    bool metric;        // units of the series
+    QVector<double> seconds;
+    QVector<double> heartBeat;
+    QVector<double> cadence;
+    QVector<double> speed;
+    QVector<double> elevationSeries;
+
+    ActivityCacheEntry() : size(0), modified(0), hasSeries(false), elevation(false), metric(true) {}
+};
+
+// Least recently used workouts, bounded by an estimate of their memory use.
+// Entries are dropped as soon as their .ttbin file changes on disk. Misses fall
+// back to the decoded copy on disk, see DecodedActivity.
+class ActivityCache
+{
+    QCache<QString, ActivityCacheEntry> m_Cache; // cost in KB
+
+    static int cost( const ActivityCacheEntry * entry );
+
+public:
+    explicit ActivityCache( int budgetKB = 64 * 1024 );
+
+    ActivityCacheEntry * find( const QString & filename );
+    // only what is in memory, no file checks and no decoded copy from disk.
+    ActivityCacheEntry * peek( const QString & filename );
+    ActivityCacheEntry * insert( const QString & filename, ActivityPtr activity );
+    void update( const QString & filename );
+    void remove( const QString & filename );
+    void clear();
+};
+
+#endif // ACTIVITYCACHE_H
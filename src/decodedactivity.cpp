@@ -0,0 +1,286 @@
+#include "decodedactivity.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QDebug>
+#include <string.h>
+
+#define DECODED_MAGIC 0x44445454 // "TTDD" in little endian, fails to match on a foreign byte order.
+#define DECODED_VERSION 1
+
+namespace
+{
+    struct Header
+    {
+        quint32 magic;
+        quint32 version;
+        qint64 sourceSize;      // identity of the .ttbin this was decoded from
+        qint64 sourceModified;
+        qint64 date;            // wall clock start time, msecs since epoch
+        quint32 duration;
+        float distance;
+        quint8 sport;
+        quint8 metric;          // units of the graph series
+        quint8 reserved[2];
+        quint32 lapCount;
+        quint32 pointCount;
+        quint32 seriesCount;
+        quint32 elevationCount;
+    };
+
+    struct LapRecord
+    {
+        double length;
+        quint32 totalSeconds;
+        qint32 calories;
+        qint32 heartBeats;
+        qint32 maxHeartBeats;
+        qint32 cadence;
+        quint32 pointCount;
+    };
+
+    // per point: latitude, longitude, altitude and speed as doubles, time,
+    // heart rate, cadence, calories and cumulative distance in 4 bytes each.
+    const qint64 POINT_SIZE = 4 * sizeof(double) + 5 * 4;
+
+    qint64 expectedSize( const Header & header )
+    {
+        return sizeof(Header) +
+                (qint64)header.lapCount * sizeof(LapRecord) +
+                (qint64)header.pointCount * POINT_SIZE +
+                ( 4 * (qint64)header.seriesCount + header.elevationCount ) * sizeof(double);
+    }
+
+    // columns are copied out of the file data, the offsets are not aligned.
+    template<typename T> void readColumn( const uchar *& p, QVector<T> & column, int count )
+    {
+        column.resize(count);
+        memcpy(column.data(), p, count * sizeof(T));
+        p += count * sizeof(T);
+    }
+
+    template<typename T> void writeColumn( QIODevice & f, const QVector<T> & column )
+    {
+        f.write((const char*)column.constData(), column.count() * sizeof(T));
+    }
+}
+
+Q_STATIC_ASSERT(sizeof(Header) == 64);
+Q_STATIC_ASSERT(sizeof(LapRecord) == 32);
+
+QString DecodedActivity::filename(const QString &ttbinFilename)
+{
+    return ttbinFilename + ".decoded";
+}
+
+bool DecodedActivity::load(const QString &ttbinFilename, ActivityCacheEntry &entry)
+{
+    QFile f(filename(ttbinFilename));
+    if ( !f.exists() || !f.open(QIODevice::ReadOnly) )
+    {
+        return false;
+    }
+
+    qint64 size = f.size();
+    if ( size < (qint64)sizeof(Header) )
+    {
+        return false;
+    }
+
+    // small enough to read in one go, the columns are copied out of it.
+    QByteArray data = f.readAll();
+    if ( data.size() != size )
+    {
+        qWarning() << "DecodedActivity::load / could not read " << f.fileName() << f.errorString();
+        return false;
+    }
+    const uchar * bytes = (const uchar*)data.constData();
+
+    Header header;
+    memcpy(&header, bytes, sizeof(header));
+
+    QFileInfo source(ttbinFilename);
+    if ( header.magic != DECODED_MAGIC ||
+         header.version != DECODED_VERSION ||
+         header.sourceSize != source.size() ||
+         header.sourceModified != source.lastModified().toMSecsSinceEpoch() ||
+         header.sport > (quint8)Activity::OTHER ||
+         size != expectedSize(header) )
+    {
+        // stale or foreign, it is written again once the workout is decoded.
+        return false;
+    }
+
+    const uchar * p = bytes + sizeof(Header);
+
+    QVector<LapRecord> laps;
+    readColumn(p, laps, header.lapCount);
+
+    int count = header.pointCount;
+    QVector<double> latitude, longitude, altitude, speed;
+    QVector<quint32> time;
+    QVector<qint32> heartRate, cadence, calories;
+    QVector<float> distance;
+    readColumn(p, latitude, count);
+    readColumn(p, longitude, count);
+    readColumn(p, altitude, count);
+    readColumn(p, speed, count);
+    readColumn(p, time, count);
+    readColumn(p, heartRate, count);
+    readColumn(p, cadence, count);
+    readColumn(p, calories, count);
+    readColumn(p, distance, count);
+
+    readColumn(p, entry.seconds, header.seriesCount);
+    readColumn(p, entry.heartBeat, header.seriesCount);
+    readColumn(p, entry.cadence, header.seriesCount);
+    readColumn(p, entry.speed, header.seriesCount);
+    readColumn(p, entry.elevationSeries, header.elevationCount);
+
+    // the start time is wall clock time tagged as local time, see TTBinReader::readTime.
+    QDateTime date = QDateTime::fromMSecsSinceEpoch(header.date, Qt::UTC);
+    date.setTimeSpec(Qt::LocalTime);
+
+    ActivityPtr activity = ActivityPtr::create();
+    activity->setFilename(ttbinFilename);
+    activity->setDate(date);
+    activity->setSport((Activity::Sport)header.sport);
+    activity->setDuration(header.duration);
+    activity->setDistance(header.distance);
+
+    int point = 0;
+    foreach ( const LapRecord & r, laps )
+    {
+        LapPtr lap = LapPtr::create();
+        lap->setLength(r.length);
+        lap->setTotalSeconds(r.totalSeconds);
+        lap->setCalories(r.calories);
+        lap->setHeartBeats(r.heartBeats);
+        lap->setMaximumHeartBeats(r.maxHeartBeats);
+        lap->setCadence(r.cadence);
+
+        TrackPointList & points = lap->points();
+        points.reserve(r.pointCount);
+        for ( quint32 i = 0; i < r.pointCount && point < count; i++, point++ )
+        {
+            TrackPointPtr tp = TrackPointPtr::create();
+            tp->setTime(QDateTime::fromTime_t(time.at(point)));
+            tp->setLatitude(latitude.at(point));
+            tp->setLongitude(longitude.at(point));
+            tp->setAltitude(altitude.at(point));
+            tp->setSpeed(speed.at(point));
+            tp->setHeartRate(heartRate.at(point));
+            tp->setCadence(cadence.at(point));
+            tp->setCalories(calories.at(point));
+            tp->setCummulativeDistance(distance.at(point));
+            points.append(tp);
+        }
+        activity->laps().append(lap);
+    }
+
+    entry.activity = activity;
+    entry.size = header.sourceSize;
+    entry.modified = header.sourceModified;
+    entry.hasSeries = true;
+    entry.elevation = true;
+    entry.metric = header.metric != 0;
+    return true;
+}
+
+bool DecodedActivity::save(const QString &ttbinFilename, const ActivityCacheEntry &entry)
+{
+    if ( !entry.activity || !entry.hasSeries || !entry.elevation )
+    {
+        return false;
+    }
+
+    ActivityPtr activity = entry.activity;
+
+    QVector<LapRecord> laps;
+    QVector<double> latitude, longitude, altitude, speed;
+    QVector<quint32> time;
+    QVector<qint32> heartRate, cadence, calories;
+    QVector<float> distance;
+    foreach ( LapPtr lap, activity->laps() )
+    {
+        LapRecord r;
+        r.length = lap->length();
+        r.totalSeconds = lap->totalSeconds();
+        r.calories = lap->calories();
+        r.heartBeats = lap->heartBeats();
+        r.maxHeartBeats = lap->maximumHeartBeats();
+        r.cadence = lap->cadence();
+        r.pointCount = lap->points().count();
+        laps.append(r);
+
+        foreach ( TrackPointPtr tp, lap->points() )
+        {
+            latitude.append(tp->latitude());
+            longitude.append(tp->longitude());
+            altitude.append(tp->altitude());
+            speed.append(tp->speed());
+            time.append(tp->time().toTime_t());
+            heartRate.append(tp->heartRate());
+            cadence.append(tp->cadence());
+            calories.append(tp->calories());
+            distance.append(tp->cummulativeDistance());
+        }
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = DECODED_MAGIC;
+    header.version = DECODED_VERSION;
+    header.sourceSize = entry.size;
+    header.sourceModified = entry.modified;
+    header.date = QDateTime(activity->date().date(), activity->date().time(), Qt::UTC).toMSecsSinceEpoch();
+    header.duration = activity->duration();
+    header.distance = activity->distance();
+    header.sport = (quint8)activity->sport();
+    header.metric = entry.metric ? 1 : 0;
+    header.lapCount = laps.count();
+    header.pointCount = time.count();
+    header.seriesCount = entry.seconds.count();
+    header.elevationCount = entry.elevationSeries.count();
+
+    if ( entry.heartBeat.count() != entry.seconds.count() ||
+         entry.cadence.count() != entry.seconds.count() ||
+         entry.speed.count() != entry.seconds.count() )
+    {
+        qWarning() << "DecodedActivity::save / series length mismatch, not saving " << ttbinFilename;
+        return false;
+    }
+
+    QSaveFile f(filename(ttbinFilename));
+    if ( !f.open(QIODevice::WriteOnly) )
+    {
+        qWarning() << "DecodedActivity::save / could not write " << f.fileName() << f.errorString();
+        return false;
+    }
+
+    f.write((const char*)&header, sizeof(header));
+    writeColumn(f, laps);
+    writeColumn(f, latitude);
+    writeColumn(f, longitude);
+    writeColumn(f, altitude);
+    writeColumn(f, speed);
+    writeColumn(f, time);
+    writeColumn(f, heartRate);
+    writeColumn(f, cadence);
+    writeColumn(f, calories);
+    writeColumn(f, distance);
+    writeColumn(f, entry.seconds);
+    writeColumn(f, entry.heartBeat);
+    writeColumn(f, entry.cadence);
+    writeColumn(f, entry.speed);
+    writeColumn(f, entry.elevationSeries);
+
+    if ( !f.commit() )
+    {
+        qWarning() << "DecodedActivity::save / could not commit " << f.fileName() << f.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,21 @@
+#ifndef DECODEDACTIVITY_H
+#define DECODEDACTIVITY_H
+
+#include <QString>
+#include "activitycache.h"
+
+// A fully decoded workout, elevation and graph series included, stored next to
+// its .ttbin as <ttbin>.decoded. A plain binary cache with the track stored
+// column wise, so opening a workout does not run the .ttbin parser, the
+// elevation JSON or the smoothing again, it still builds the track points.
+// The file records the size and modification time of its .ttbin and is
+// ignored once that changes.
+class DecodedActivity
+{
+public:
+    static QString filename( const QString & ttbinFilename );
+    static bool load( const QString & ttbinFilename, ActivityCacheEntry & entry );
+    static bool save( const QString & ttbinFilename, const ActivityCacheEntry & entry );
+};
+
+#endif // DECODEDACTIVITY_H
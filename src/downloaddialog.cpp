@@ -15,6 +15,8 @@
 #include "singleshot.h"
 #include "ttbinreader.h"
 #include "elevationloader.h"
+#include "watchworker.h"
+#include "workoutpreparer.h"
 
 void DownloadDialog::showEvent(QShowEvent *e)
 {
@@ -34,9 +36,17 @@ DownloadDialog::DownloadDialog(Settings *settings, TTManager *ttManager, QWidget
     QDialog(parent),
     m_Settings(settings),
     m_TTManager(ttManager),
+    m_ManualDownload(false),
+    m_ShouldDownloadQuickFix(false),
+    m_Cancelled(0),
+    m_Preparing(0),
+    m_FetchingQuickFix(false),
     ui(new Ui::DownloadDialog)
 {
     ui->setupUi(this);
+    qRegisterMetaType<ActivityPtr>("ActivityPtr");
+    // elevation lookups mostly wait on the network, a few at a time is plenty.
+    m_PreparePool.setMaxThreadCount( qBound(2, QThread::idealThreadCount(), 4) );
     connect(&m_Manager, SIGNAL(finished(QNetworkReply*)), this, SLOT(onFinished(QNetworkReply*)));
     connect(m_TTManager, SIGNAL(allExportingFinished()), this, SLOT(onExportingFinished()));
     connect(m_TTManager, SIGNAL(exportError(QString)), this, SLOT(onExportError(QString)));
@@ -51,6 +61,9 @@ DownloadDialog::DownloadDialog(Settings *settings, TTManager *ttManager, QWidget
 
 DownloadDialog::~DownloadDialog()
 {
+    // the preparers use m_Cancelled and call back into this.
+    m_Cancelled.store(1);
+    m_PreparePool.waitForDone();
     delete ui;
 }
 
@@ -75,7 +88,11 @@ QStringList DownloadDialog::filesDownloaded() const
 
 void DownloadDialog::process()
 {
-    bool shouldDownloadQuickFix = false;
+    m_ShouldDownloadQuickFix = false;
+    m_Cancelled.store(0);
+    m_Downloading.clear();
+    m_Progress.clear();
+    m_Preparing = 0;
 
     if ( m_TTManager->watches().count() == 0 )
     {
@@ -83,6 +100,8 @@ void DownloadDialog::process()
         return;
     }
 
+    // every watch downloads on its own worker thread at the same time, the
+    // downloaded workouts share m_PreparePool.
     foreach ( TTWatch * watch, m_TTManager->watches())
     {
 
@@ -91,91 +110,169 @@ void DownloadDialog::process()
             continue;
         }
 
+        WatchWorker * worker = m_TTManager->worker( watch->serial() );
+        if ( !worker )
+        {
+            continue;
+        }
+
         WatchExportersPtr exporters = m_TTManager->exporters( watch->serial());
 
         /**********************************************/
         /* 1. LOAD TTBINS */
         /**********************************************/
 
-        workInfo(tr("Downloading .ttbins"), false);
+        workInfo(tr("Downloading .ttbins from %1").arg(exporters->name()), false);
 
-        QStringList files = watch->download(Settings::ttdir() + QDir::separator() + exporters->name(), true);
+        connect(worker, SIGNAL(progress(quint32,qint64,qint64)), this, SLOT(onProgress(quint32,qint64,qint64)), Qt::UniqueConnection);
+        connect(worker, SIGNAL(downloaded(QStringList,ActivityList)), this, SLOT(onDownloaded(QStringList,ActivityList)), Qt::UniqueConnection);
+        connect(worker, SIGNAL(stopped()), this, SLOT(onWorkerStopped()), Qt::UniqueConnection);
+        m_Downloading.insert(worker);
+        worker->download(Settings::ttdir() + QDir::separator() + exporters->name(), true);
+    }
 
-        if ( files.count() > 0 )
-        {
-            emit filesAvailable();
+    ui->cancelButton->setEnabled(true);
+    checkDone();
+}
+
+void DownloadDialog::checkDone()
+{
+    if ( !m_Downloading.isEmpty() || m_Preparing > 0 )
+    {
+        return;
+    }
+
+    ui->cancelButton->setEnabled(false);
+    ui->progressBar->reset();
+    if ( m_Cancelled.load() )
+    {
+        workInfo(tr("Cancelled."), true);
+    }
+    else
+    {
+        applyQuickFix();
+    }
+}
+
+void DownloadDialog::onProgress(quint32 fileId, qint64 done, qint64 total)
+{
+    Q_UNUSED(fileId);
+    WatchWorker * worker = qobject_cast<WatchWorker*>(sender());
+    if ( !worker || !m_Downloading.contains(worker) )
+    {
+        return;
+    }
+
+    // one bar for all watches, the files they are busy with added up.
+    m_Progress[worker] = qMakePair(done, total);
+    qint64 allDone = 0, allTotal = 0;
+    foreach ( const Progress & p, m_Progress )
+    {
+        allDone += p.first;
+        allTotal += p.second;
+    }
+    ui->progressBar->setMaximum( (int)( allTotal / 1024 ) );
+    ui->progressBar->setValue( (int)( allDone / 1024 ) );
+}
 
-            workInfo(tr("Exporting .ttbins"), false);
+void DownloadDialog::onDownloaded(QStringList files, ActivityList activities)
+{
+    WatchWorker * worker = qobject_cast<WatchWorker*>(sender());
+    if ( !worker || !m_Downloading.remove(worker) )
+    {
+        return;
+    }
+    disconnect(worker, 0, this, 0);
+    m_Progress.remove(worker);
+
+    QString serial = worker->watch()->serial();
+
+    if ( files.count() > 0 )
+    {
+        emit filesAvailable();
 
+        workInfo(tr("Exporting .ttbins"), false);
+
+        /**********************************************/
+        /* 2. EXPORT TTBINS */
+        /**********************************************/
+
+        for ( int i = 0; i < files.count(); i++ )
+        {
             /**********************************************/
-            /* 2. EXPORT TTBINS */
+            /* 3. Read TTBIN, 4. Load Elevation Data */
             /**********************************************/
 
-            foreach ( const QString & filename, files )
-            {
-                /**********************************************/
-                /* 3. Read TTBIN */
-                /**********************************************/
-
-                workInfo(tr("Reading .ttbin %1").arg(filename), false);
-
-                TTBinReader br;
-                ActivityPtr a = br.read(filename, true);
-                if ( !a )
-                {
-                    workInfo(tr("failed to parse %1.").arg(filename), false);
-                    qDebug() << "DownloadDialog::process / could not parse file " << filename;
-                    continue;
-                }
-
-                /**********************************************/
-                /* 4. Load Elevation Data */
-                /**********************************************/
-
-                workInfo(tr("Downloading Elevation Data for %1.").arg(filename), false);
-                ElevationLoader el;
-                if ( el.load(a, true) != ElevationLoader::SUCCESS )
-                {
-                    workInfo(tr("failed to download elevation data for %1.").arg(filename), false);
-                    continue;
-                }
-
-                /**********************************************/
-                /* 5. Export TTBIN */
-                /**********************************************/
-
-                workInfo(tr("Exporting .ttbin . %1").arg(filename), false);
-
-                if ( !exporters->exportActivity(a) )
-                {
-                    workInfo(tr("Exporting .ttbin failed. %1").arg(filename), false);
-                    continue;
-                }
-            }
-
-            m_Files.append( files );
-        }
-        else
-        {
-            workInfo(tr("No new workouts."), false);
+            // parsed while it was downloading, WorkoutPreparer only reads it
+            // again when that failed.
+            m_Preparing++;
+            m_PreparePool.start( new WorkoutPreparer(this, serial, files.at(i), activities.value(i), m_Cancelled) );
         }
 
-        QDateTime lastFixUpload = m_Settings->lastQuickFix(watch->serial());
-        QDateTime now = QDateTime::currentDateTime();
-        if ( lastFixUpload.secsTo(now) > 24 * 3600 )
+        m_Files.append( files );
+    }
+    else
+    {
+        workInfo(tr("No new workouts."), false);
+    }
+
+    QDateTime lastFixUpload = m_Settings->lastQuickFix( serial );
+    QDateTime now = QDateTime::currentDateTime();
+    if ( lastFixUpload.secsTo(now) > 24 * 3600 )
+    {
+        m_ShouldDownloadQuickFix = true;
+    }
+
+    checkDone();
+}
+
+void DownloadDialog::onWorkoutPrepared(QString serial, QString filename, ActivityPtr activity, int result)
+{
+    m_Preparing--;
+
+    switch ( result )
+    {
+    case WorkoutPreparer::PARSE_FAILED:
+        workInfo(tr("failed to parse %1.").arg(filename), false);
+        break;
+
+    case WorkoutPreparer::ELEVATION_FAILED:
+        workInfo(tr("failed to download elevation data for %1.").arg(filename), false);
+        break;
+
+    case WorkoutPreparer::PREPARED:
+    {
+        /**********************************************/
+        /* 5. Export TTBIN */
+        /**********************************************/
+
+        workInfo(tr("Exporting .ttbin . %1").arg(filename), false);
+
+        WatchExportersPtr exporters = m_TTManager->exporters( serial );
+        if ( !exporters->exportActivity(activity) )
         {
-            shouldDownloadQuickFix = true;
+            workInfo(tr("Exporting .ttbin failed. %1").arg(filename), false);
         }
+        break;
+    }
 
+    default:
+        break;
     }
 
+    checkDone();
+}
+
+void DownloadDialog::applyQuickFix()
+{
     /**********************************************/
     /* 6. APPLY GPS QUICK FIX DATA */
     /**********************************************/
 
-    if ( shouldDownloadQuickFix )
+    if ( m_ShouldDownloadQuickFix )
     {
         workInfo(tr("Downloading GPS Quick Fix data"), false);
+        m_FetchingQuickFix = true;
         QNetworkRequest r;
         r.setUrl(QUrl( "http://gpsquickfix.services.tomtom.com/fitness/sifgps.f2p3enc.ee"));
         m_Manager.get(r);
@@ -186,10 +283,21 @@ void DownloadDialog::process()
     }
 }
 
+void DownloadDialog::on_cancelButton_clicked()
+{
+    workInfo(tr("Cancelling..."), false);
+    m_Cancelled.store(1);
+    ui->cancelButton->setEnabled(false);
+    foreach ( WatchWorker * worker, m_Downloading )
+    {
+        worker->cancel();
+    }
+}
+
 void DownloadDialog::workInfo(const QString &message, bool done)
 {    
     ui->logWidget->addItem(message);
-    qApp->processEvents();
+    ui->logWidget->scrollToBottom();
     if ( done )
     {
         QMetaObject::invokeMethod(this, "accept",Qt::QueuedConnection);
@@ -198,6 +306,7 @@ void DownloadDialog::workInfo(const QString &message, bool done)
 
 void DownloadDialog::onFinished(QNetworkReply *reply)
 {
+    m_FetchingQuickFix = false;
     if ( reply->error() != QNetworkReply::NoError )
     {
        workInfo(tr("Download QuickFix Data Failed."),true);
@@ -207,25 +316,83 @@ void DownloadDialog::onFinished(QNetworkReply *reply)
     QByteArray data = reply->readAll();
     reply->deleteLater();
 
+    m_QuickFixWriting.clear();
     foreach ( TTWatch * watch, m_TTManager->watches())
     {
-        workInfo(tr("Writing GPS Quick Fix data to %1...").arg(watch->serial()), false);
-        if ( watch->writeFile( data, FILE_GPSQUICKFIX_DATA, true ) )
-        {
-            qDebug() << "PostGPS FIX" << watch->postGPSFix();
-            m_Settings->setQuickFixDate( watch->serial(), QDateTime::currentDateTime());
-        }
-        else
+        WatchWorker * worker = m_TTManager->worker( watch->serial() );
+        if ( !worker )
         {
-            qDebug() << "GPS Fix failed.";
+            continue;
         }
+
+        workInfo(tr("Writing GPS Quick Fix data to %1...").arg(watch->serial()), false);
+        connect(worker, SIGNAL(fileWritten(quint32,bool)), this, SLOT(onQuickFixWritten(quint32,bool)), Qt::UniqueConnection);
+        connect(worker, SIGNAL(stopped()), this, SLOT(onWorkerStopped()), Qt::UniqueConnection);
+        m_QuickFixWriting.insert(worker);
+        worker->writeFile( data, FILE_GPSQUICKFIX_DATA );
+    }
+
+    if ( m_QuickFixWriting.isEmpty() )
+    {
+        onExportingFinished();
+    }
+}
+
+void DownloadDialog::onQuickFixWritten(quint32 fileId, bool ok)
+{
+    WatchWorker * worker = qobject_cast<WatchWorker*>(sender());
+    if ( fileId != FILE_GPSQUICKFIX_DATA || !worker || !m_QuickFixWriting.remove(worker) )
+    {
+        return;
+    }
+    disconnect(worker, SIGNAL(fileWritten(quint32,bool)), this, SLOT(onQuickFixWritten(quint32,bool)));
+
+    if ( ok )
+    {
+        worker->postGPSFix();
+        m_Settings->setQuickFixDate( worker->watch()->serial(), QDateTime::currentDateTime());
+    }
+    else
+    {
+        qDebug() << "GPS Fix failed.";
+    }
+
+    if ( m_QuickFixWriting.isEmpty() )
+    {
+        onExportingFinished();
+    }
+}
+
+void DownloadDialog::onWorkerStopped()
+{
+    // the watch went away, its worker answers nothing anymore.
+    WatchWorker * worker = qobject_cast<WatchWorker*>(sender());
+    if ( !worker )
+    {
+        return;
     }
 
-    onExportingFinished();
+    m_Progress.remove(worker);
+    if ( m_Downloading.remove(worker) )
+    {
+        workInfo(tr("%1 disconnected.").arg(worker->watch()->serial()), false);
+        checkDone();
+    }
+    else if ( m_QuickFixWriting.remove(worker) && m_QuickFixWriting.isEmpty() )
+    {
+        onExportingFinished();
+    }
 }
 
 void DownloadDialog::onExportingFinished()
 {
+    // each watch reports its exports done on its own, the other watches may
+    // still be downloading. checkDone() gets here once everything is through.
+    if ( !m_Downloading.isEmpty() || m_Preparing > 0 || m_FetchingQuickFix || !m_QuickFixWriting.isEmpty() )
+    {
+        return;
+    }
+
     bool stillExporting = false;
     WatchExportersMap::iterator i = m_TTManager->exporters().begin();
     for(;i!=m_TTManager->exporters().end();i++)
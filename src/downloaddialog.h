@@ -3,9 +3,15 @@
 
 #include <QDialog>
 #include <QNetworkAccessManager>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QSet>
+#include <QHash>
+#include <QPair>
 
 #include "ttmanager.h"
 #include "settings.h"
+#include "watchworker.h"
 
 namespace Ui {
 class DownloadDialog;
@@ -19,6 +25,19 @@ class DownloadDialog : public QDialog
     QNetworkAccessManager m_Manager;
     QStringList m_Files;
     bool m_ManualDownload;
+    typedef QPair<qint64, qint64> Progress; // bytes done, total of the current file
+
+    QSet<WatchWorker*> m_Downloading;
+    QHash<WatchWorker*, Progress> m_Progress;
+    QThreadPool m_PreparePool;
+    bool m_ShouldDownloadQuickFix;
+    QAtomicInt m_Cancelled;
+    int m_Preparing; // workouts in m_PreparePool
+    QSet<WatchWorker*> m_QuickFixWriting;
+    bool m_FetchingQuickFix;
+
+    void checkDone();
+    void applyQuickFix();
 
 protected:
     void showEvent(QShowEvent *e);
@@ -33,6 +52,12 @@ signals:
 private slots:
     void process();
     void workInfo( const QString & message, bool done );
+    void onProgress( quint32 fileId, qint64 done, qint64 total );
+    void onDownloaded( QStringList files, ActivityList activities );
+    void onWorkoutPrepared( QString serial, QString filename, ActivityPtr activity, int result );
+    void onQuickFixWritten( quint32 fileId, bool ok );
+    void onWorkerStopped();
+    void on_cancelButton_clicked();
     void onFinished(QNetworkReply * reply );
     void onExportingFinished();
     void onExportError( QString message );
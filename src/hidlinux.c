@@ -115,12 +115,10 @@ libusb HIDAPI programs are encouraged to use the interface number
 instead to differentiate between interfaces on a composite HID device. */
 /*#define INVASIVE_GET_USAGE*/
 
-/* Linked List of input reports received from the device. */
-struct input_report {
-	uint8_t *data;
-	size_t len;
-	struct input_report *next;
-};
+/* Number of input reports kept when nobody reads them. When the ring is
+   full the oldest report is dropped, so it does not grow if the user never
+   reads anything from the device. */
+#define INPUT_REPORT_SLOTS 32
 
 
 struct hid_device_ {
@@ -145,14 +143,25 @@ struct hid_device_ {
 	
 	/* Read thread objects */
 	pthread_t thread;
-	pthread_mutex_t mutex; /* Protects input_reports */
+	pthread_mutex_t mutex; /* Protects the report ring and the waiting reader */
 	pthread_cond_t condition;
 	pthread_barrier_t barrier; /* Ensures correct startup sequence */
 	int shutdown_thread;
 	struct libusb_transfer *transfer;
 
-	/* List of received input reports. */
-	struct input_report *input_reports;
+	/* Ring of received input reports, INPUT_REPORT_SLOTS slots of
+	   input_ep_max_packet_size bytes allocated once by read_thread(). */
+	uint8_t *report_data;
+	size_t report_len[INPUT_REPORT_SLOTS];
+	int report_head; /* slot of the oldest report */
+	int report_count;
+
+	/* A reader waiting in hid_read_timeout() leaves its buffer here, so
+	   read_callback() copies the next report straight into it. */
+	unsigned char *waiting_data;
+	size_t waiting_length;
+	unsigned char *filled_data; /* waiting_data once a report was copied in */
+	int filled_length;
 };
 
 static libusb_context *usb_context = NULL;
@@ -694,37 +703,36 @@ static void read_callback(struct libusb_transfer *transfer)
 	int res;
 	
 	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
-
-		struct input_report *rpt = malloc(sizeof(*rpt));
-		rpt->data = malloc(transfer->actual_length);
-		memcpy(rpt->data, transfer->buffer, transfer->actual_length);
-		rpt->len = transfer->actual_length;
-		rpt->next = NULL;
+		size_t len = transfer->actual_length;
 
 		pthread_mutex_lock(&dev->mutex);
 
-		/* Attach the new report object to the end of the list. */
-		if (dev->input_reports == NULL) {
-			/* The list is empty. Put it at the root. */
-			dev->input_reports = rpt;
-			pthread_cond_signal(&dev->condition);
+		if (dev->waiting_data && dev->report_count == 0) {
+			/* A reader is already waiting, hand the report over
+			   without queueing it. */
+			size_t copy = (dev->waiting_length < len)? dev->waiting_length: len;
+			memcpy(dev->waiting_data, transfer->buffer, copy);
+			dev->filled_data = dev->waiting_data;
+			dev->filled_length = copy;
+			dev->waiting_data = NULL;
+			pthread_cond_broadcast(&dev->condition);
 		}
 		else {
-			/* Find the end of the list and attach. */
-			struct input_report *cur = dev->input_reports;
-			int num_queued = 0;
-			while (cur->next != NULL) {
-				cur = cur->next;
-				num_queued++;
-			}
-			cur->next = rpt;
-			
-			/* Pop one off if we've reached 30 in the queue. This
-			   way we don't grow forever if the user never reads
-			   anything from the device. */
-			if (num_queued > 30) {
+			int slot;
+
+			/* Drop the oldest report if the ring is full. */
+			if (dev->report_count == INPUT_REPORT_SLOTS) {
 				return_data(dev, NULL, 0);
-			}			
+			}
+
+			slot = (dev->report_head + dev->report_count) % INPUT_REPORT_SLOTS;
+			memcpy(dev->report_data + slot * dev->input_ep_max_packet_size, transfer->buffer, len);
+			dev->report_len[slot] = len;
+			dev->report_count++;
+
+			if (dev->report_count == 1) {
+				pthread_cond_signal(&dev->condition);
+			}
 		}
 		pthread_mutex_unlock(&dev->mutex);
 	}
@@ -758,8 +766,10 @@ static void *read_thread(void *param)
 	unsigned char *buf;
 	const size_t length = dev->input_ep_max_packet_size;
 
-	/* Set up the transfer object. */
+	/* Set up the transfer object and the report ring, nothing is allocated
+	   per report after this. */
 	buf = malloc(length);
+	dev->report_data = malloc(INPUT_REPORT_SLOTS * length);
 	dev->transfer = libusb_alloc_transfer(0);
 	libusb_fill_interrupt_transfer(dev->transfer,
 		dev->device_handle,
@@ -1011,21 +1021,49 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
    This should be called with dev->mutex locked. */
 static int return_data(hid_device *dev, unsigned char *data, size_t length)
 {
-	/* Copy the data out of the linked list item (rpt) into the
-	   return buffer (data), and delete the liked list item. */
-	struct input_report *rpt = dev->input_reports;
-	size_t len = (length < rpt->len)? length: rpt->len;
+	/* Copy the oldest report in the ring into the return buffer (data)
+	   and free its slot. */
+	int slot = dev->report_head;
+	size_t len = (length < dev->report_len[slot])? length: dev->report_len[slot];
 	if (len > 0)
-		memcpy(data, rpt->data, len);
-	dev->input_reports = rpt->next;
-	free(rpt->data);
-	free(rpt);
+		memcpy(data, dev->report_data + slot * dev->input_ep_max_packet_size, len);
+	dev->report_head = (slot + 1) % INPUT_REPORT_SLOTS;
+	dev->report_count--;
 	return len;
 }
 
+/* Offer data to read_callback() for the next report, unless another reader
+   already did or has not collected its report yet. Called with dev->mutex
+   locked. */
+static void start_waiting(hid_device *dev, unsigned char *data, size_t length)
+{
+	if (!dev->waiting_data && !dev->filled_data) {
+		dev->waiting_data = data;
+		dev->waiting_length = length;
+	}
+}
+
+/* Takes data back from read_callback(), returns the length of the report
+   copied into it or -1 if none was. Called with dev->mutex locked. */
+static int stop_waiting(hid_device *dev, unsigned char *data)
+{
+	if (dev->waiting_data == data) {
+		dev->waiting_data = NULL;
+		return -1;
+	}
+	if (dev->filled_data == data) {
+		dev->filled_data = NULL;
+		return dev->filled_length;
+	}
+	return -1;
+}
+
 static void cleanup_mutex(void *param)
 {
 	hid_device *dev = param;
+	/* A cancelled reader must not leave its buffer behind. */
+	dev->waiting_data = NULL;
+	dev->filled_data = NULL;
 	pthread_mutex_unlock(&dev->mutex);
 }
 
@@ -1045,7 +1083,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	pthread_cleanup_push(&cleanup_mutex, dev);
 
 	/* There's an input report queued up. Return it. */
-	if (dev->input_reports) {
+	if (dev->report_count > 0) {
 		/* Return the first one */
 		bytes_read = return_data(dev, data, length);
 		goto ret;
@@ -1060,16 +1098,18 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	
 	if (milliseconds == -1) {
 		/* Blocking */
-		while (!dev->input_reports && !dev->shutdown_thread) {
+		start_waiting(dev, data, length);
+		while (dev->filled_data != data && dev->report_count == 0 && !dev->shutdown_thread) {
 			pthread_cond_wait(&dev->condition, &dev->mutex);
 		}
-		if (dev->input_reports) {
+		bytes_read = stop_waiting(dev, data);
+		if (bytes_read < 0 && dev->report_count > 0) {
 			bytes_read = return_data(dev, data, length);
 		}
 	}
 	else if (milliseconds > 0) {
 		/* Non-blocking, but called with timeout. */
-		int res;
+		int res = 0;
 		struct timespec ts;
 
 
@@ -1094,27 +1134,30 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			ts.tv_nsec -= 1000000000L;
 		}
 		
-		while (!dev->input_reports && !dev->shutdown_thread) {
+		start_waiting(dev, data, length);
+		while (dev->filled_data != data && dev->report_count == 0 && !dev->shutdown_thread) {
 			res = pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
-			if (res == 0) {
-				if (dev->input_reports) {
-					bytes_read = return_data(dev, data, length);
-					break;
-				}
-				
-				/* If we're here, there was a spurious wake up
-				   or the read thread was shutdown. Run the
-				   loop again (ie: don't break). */
+			/* On 0 there was a report, a spurious wake up or the
+			   read thread was shutdown. Check again (ie: don't
+			   break). */
+			if (res != 0) {
+				break;
+			}
+		}
+
+		/* A report handed over while timing out still counts. */
+		bytes_read = stop_waiting(dev, data);
+		if (bytes_read < 0) {
+			if (dev->report_count > 0) {
+				bytes_read = return_data(dev, data, length);
 			}
 			else if (res == ETIMEDOUT) {
 				/* Timed out. */
 				bytes_read = 0;
-				break;
 			}
 			else {
-				/* Error. */
+				/* Error or shutdown. */
 				bytes_read = -1;
-				break;
 			}
 		}
 	}
@@ -1226,11 +1269,11 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	/* Close the handle */
 	libusb_close(dev->device_handle);
 	
-	/* Clear out the queue of received reports. */
+	/* Clear out the ring of received reports. */
 	pthread_mutex_lock(&dev->mutex);
-	while (dev->input_reports) {
-		return_data(dev, NULL, 0);
-	}
+	dev->report_count = 0;
+	free(dev->report_data);
+	dev->report_data = NULL;
 	pthread_mutex_unlock(&dev->mutex);
 	
 	free_hid_device(dev);
@@ -0,0 +1,55 @@
+#include "hidwatchtransport.h"
+
+HidWatchTransport::HidWatchTransport(const QString &path) :
+    m_Path(path),
+    m_Device(0)
+{
+}
+
+HidWatchTransport::~HidWatchTransport()
+{
+    close();
+}
+
+bool HidWatchTransport::open()
+{
+    if ( m_Device )
+    {
+        return true;
+    }
+
+    m_Device = hid_open_path( m_Path.toLocal8Bit().data() );
+    return m_Device != 0;
+}
+
+void HidWatchTransport::close()
+{
+    if ( m_Device )
+    {
+        hid_close(m_Device);
+        m_Device = 0;
+    }
+}
+
+bool HidWatchTransport::isOpen() const
+{
+    return m_Device != 0;
+}
+
+int HidWatchTransport::write(const quint8 *report, int length)
+{
+    if ( !m_Device )
+    {
+        return -1;
+    }
+    return hid_write(m_Device, report, length);
+}
+
+int HidWatchTransport::read(quint8 *report, int length, int timeoutMs)
+{
+    if ( !m_Device )
+    {
+        return -1;
+    }
+    return hid_read_timeout(m_Device, report, length, timeoutMs);
+}
@@ -0,0 +1,26 @@
+#ifndef HIDWATCHTRANSPORT_H
+#define HIDWATCHTRANSPORT_H
+
+#include <QString>
+#include "iwatchtransport.h"
+#include "hidapi.h"
+
+class HidWatchTransport : public IWatchTransport
+{
+    QString m_Path;
+    hid_device * m_Device;
+
+public:
+    explicit HidWatchTransport( const QString & path );
+    ~HidWatchTransport();
+
+    bool open();
+    void close();
+    bool isOpen() const;
+    bool isDevice() const { return true; }
+
+    int write( const quint8 * report, int length );
+    int read( quint8 * report, int length, int timeoutMs );
+};
+
+#endif // HIDWATCHTRANSPORT_H
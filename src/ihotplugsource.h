@@ -0,0 +1,25 @@
+#ifndef IHOTPLUGSOURCE_H
+#define IHOTPLUGSOURCE_H
+
+#include <QObject>
+
+// Tells TTManager when watches may have been plugged in or pulled out, so it
+// only enumerates the USB devices when something changed. See
+// NetlinkHotplugSource for the Linux one, anything that emits devicesChanged()
+// will do to drive TTManager without hardware.
+class IHotplugSource : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit IHotplugSource( QObject * parent = 0 ) : QObject(parent) {}
+    virtual ~IHotplugSource() {}
+
+    // false when no events will come, the caller has to poll then.
+    virtual bool start() = 0;
+
+signals:
+    void devicesChanged();
+};
+
+#endif // IHOTPLUGSOURCE_H
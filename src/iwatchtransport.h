@@ -0,0 +1,27 @@
+#ifndef IWATCHTRANSPORT_H
+#define IWATCHTRANSPORT_H
+
+#include <QtGlobal>
+
+#define WATCH_REPORT_SIZE 64
+
+// Moves the 64 byte reports of the watch protocol between TTWatch and a
+// watch, see HidWatchTransport for the real thing.
+class IWatchTransport
+{
+public:
+    virtual ~IWatchTransport() {}
+
+    virtual bool open() = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() const = 0;
+
+    // true for a watch that comes and goes with the USB device list.
+    virtual bool isDevice() const = 0;
+
+    // both return the number of bytes transferred, less than length on failure.
+    virtual int write( const quint8 * report, int length ) = 0;
+    virtual int read( quint8 * report, int length, int timeoutMs ) = 0;
+};
+
+#endif // IWATCHTRANSPORT_H
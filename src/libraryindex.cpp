@@ -0,0 +1,240 @@
+#include "libraryindex.h"
+
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QVector>
+#include <QDebug>
+#include <algorithm>
+
+#define LIBRARY_INDEX_MAGIC 0x494c5454 // "TTLI" in little endian, fails to match on a foreign byte order.
+#define LIBRARY_INDEX_VERSION 3
+
+Q_STATIC_ASSERT(sizeof(LibraryIndexRecord) == 64);
+
+static bool recordLessThan( const LibraryIndexRecord & a, const LibraryIndexRecord & b )
+{
+    return a.pathHash < b.pathHash;
+}
+
+static bool recordHashLessThan( const LibraryIndexRecord & a, quint64 pathHash )
+{
+    return a.pathHash < pathHash;
+}
+
+LibraryIndex::LibraryIndex(const QString &filename) :
+    m_Filename(filename),
+    m_Map(0),
+    m_Records(0),
+    m_Count(0),
+    m_Dirty(false)
+{
+}
+
+LibraryIndex::~LibraryIndex()
+{
+    close();
+}
+
+bool LibraryIndex::open()
+{
+    close();
+
+    m_File.setFileName(m_Filename);
+    if ( !m_File.exists() )
+    {
+        return false;
+    }
+
+    if ( !m_File.open(QIODevice::ReadOnly) )
+    {
+        qWarning() << "LibraryIndex::open / could not open " << m_Filename;
+        return false;
+    }
+
+    qint64 size = m_File.size();
+    if ( size < (qint64)sizeof(Header) )
+    {
+        qWarning() << "LibraryIndex::open / index file truncated, ignoring it.";
+        close();
+        return false;
+    }
+
+    m_Map = m_File.map(0, size);
+    if ( !m_Map )
+    {
+        qWarning() << "LibraryIndex::open / could not map " << m_Filename << m_File.errorString();
+        close();
+        return false;
+    }
+
+    const Header * header = (const Header *)m_Map;
+    if ( header->magic != LIBRARY_INDEX_MAGIC ||
+         header->version != LIBRARY_INDEX_VERSION ||
+         header->recordSize != sizeof(LibraryIndexRecord) ||
+         size != (qint64)sizeof(Header) + (qint64)header->count * (qint64)sizeof(LibraryIndexRecord) )
+    {
+        qWarning() << "LibraryIndex::open / index file has an unknown format, ignoring it.";
+        close();
+        return false;
+    }
+
+    m_Count = header->count;
+    m_Records = (const LibraryIndexRecord *)(m_Map + sizeof(Header));
+    return true;
+}
+
+void LibraryIndex::close()
+{
+    if ( m_Map )
+    {
+        m_File.unmap(m_Map);
+        m_Map = 0;
+    }
+    m_File.close();
+    m_Records = 0;
+    m_Count = 0;
+}
+
+const LibraryIndexRecord *LibraryIndex::findMapped(quint64 pathHash) const
+{
+    if ( !m_Records )
+    {
+        return 0;
+    }
+
+    const LibraryIndexRecord * end = m_Records + m_Count;
+    const LibraryIndexRecord * it = std::lower_bound(m_Records, end, pathHash, recordHashLessThan);
+    if ( it == end || it->pathHash != pathHash )
+    {
+        return 0;
+    }
+    return it;
+}
+
+bool LibraryIndex::lookup(const QString &filename, LibraryIndexRecord &record)
+{
+    quint64 pathHash = hashPath(filename);
+
+    const LibraryIndexRecord * found = 0;
+    QHash<quint64, LibraryIndexRecord>::const_iterator pending = m_Pending.constFind(pathHash);
+    if ( pending != m_Pending.constEnd() )
+    {
+        found = &pending.value();
+    }
+    else
+    {
+        found = findMapped(pathHash);
+    }
+
+    if ( !found )
+    {
+        return false;
+    }
+
+    // an entry is only valid as long as the workout file did not change.
+    QFileInfo fi(filename);
+    if ( found->size != fi.size() || found->modified != fi.lastModified().toMSecsSinceEpoch() )
+    {
+        return false;
+    }
+
+    record = *found;
+    m_Seen.insert(pathHash);
+    return true;
+}
+
+void LibraryIndex::insert(const QString &filename, const LibraryIndexRecord &record)
+{
+    QFileInfo fi(filename);
+
+    LibraryIndexRecord r = record;
+    r.pathHash = hashPath(filename);
+    r.size = fi.size();
+    r.modified = fi.lastModified().toMSecsSinceEpoch();
+
+    m_Pending.insert(r.pathHash, r);
+    m_Seen.insert(r.pathHash);
+    m_Dirty = true;
+}
+
+void LibraryIndex::remove(const QString &filename)
+{
+    quint64 pathHash = hashPath(filename);
+    m_Pending.remove(pathHash);
+    if ( m_Seen.remove(pathHash) )
+    {
+        m_Dirty = true;
+    }
+}
+
+bool LibraryIndex::save()
+{
+    // only workouts that were seen during this session are written back, this
+    // drops the entries of files that were deleted while we were not running.
+    QVector<LibraryIndexRecord> records;
+    records.reserve(m_Seen.count());
+    for ( quint32 i = 0; i < m_Count; i++ )
+    {
+        const LibraryIndexRecord & r = m_Records[i];
+        if ( m_Seen.contains(r.pathHash) && !m_Pending.contains(r.pathHash) )
+        {
+            records.append(r);
+        }
+    }
+
+    if ( !m_Dirty && (quint32)records.count() == m_Count )
+    {
+        return true;
+    }
+
+    foreach ( const LibraryIndexRecord & r, m_Pending )
+    {
+        records.append(r);
+    }
+    std::sort(records.begin(), records.end(), recordLessThan);
+
+    Header header;
+    header.magic = LIBRARY_INDEX_MAGIC;
+    header.version = LIBRARY_INDEX_VERSION;
+    header.recordSize = sizeof(LibraryIndexRecord);
+    header.count = records.count();
+
+    // the mapping has to go before the file can be replaced (Windows does not
+    // allow renaming over a mapped file), the records were copied above.
+    close();
+
+    QSaveFile f(m_Filename);
+    if ( !f.open(QIODevice::WriteOnly) )
+    {
+        qWarning() << "LibraryIndex::save / could not write " << m_Filename << f.errorString();
+        open();
+        return false;
+    }
+
+    f.write((const char*)&header, sizeof(header));
+    f.write((const char*)records.constData(), records.count() * sizeof(LibraryIndexRecord));
+    if ( !f.commit() )
+    {
+        qWarning() << "LibraryIndex::save / could not commit " << m_Filename << f.errorString();
+        open();
+        return false;
+    }
+
+    m_Pending.clear();
+    m_Dirty = false;
+    return open();
+}
+
+quint64 LibraryIndex::hashPath(const QString &filename)
+{
+    // 64 bit FNV-1a, qHash is only 32 bits which collides too easily for large libraries.
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    const ushort * p = filename.utf16();
+    for ( int i = 0; i < filename.length(); i++ )
+    {
+        hash ^= p[i];
+        hash *= Q_UINT64_C(1099511628211);
+    }
+    return hash;
+}
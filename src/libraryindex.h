@@ -0,0 +1,62 @@
+#ifndef LIBRARYINDEX_H
+#define LIBRARYINDEX_H
+
+#include <QString>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+
+// One fixed size record per workout. The records are stored sorted on pathHash,
+// so they can be searched directly in the memory mapped index file.
+struct LibraryIndexRecord
+{
+    enum Metric { METRIC_CALORIES, METRIC_TRIMP, METRIC_COUNT = 5 };
+
+    quint64 pathHash;
+    qint64 size;        // size of the .ttbin file, used to detect stale entries
+    qint64 modified;    // last modification of the .ttbin file, msecs since epoch
+    qint64 startTime;   // wall clock start time, msecs since epoch
+    quint32 duration;   // seconds
+    qint32 distance;    // meters
+    quint8 sport;
+    quint8 reserved[3];
+    float metrics[METRIC_COUNT]; // room for derived metrics
+};
+
+class LibraryIndex
+{
+    struct Header
+    {
+        quint32 magic;
+        quint32 version;
+        quint32 recordSize;
+        quint32 count;
+    };
+
+    QString m_Filename;
+    QFile m_File;
+    uchar * m_Map;
+    const LibraryIndexRecord * m_Records;
+    quint32 m_Count;
+    QHash<quint64, LibraryIndexRecord> m_Pending;
+    QSet<quint64> m_Seen;
+    bool m_Dirty;
+
+    const LibraryIndexRecord * findMapped( quint64 pathHash ) const;
+
+public:
+    explicit LibraryIndex( const QString & filename );
+    ~LibraryIndex();
+
+    bool open();
+    void close();
+    bool save();
+
+    bool lookup( const QString & filename, LibraryIndexRecord & record );
+    void insert( const QString & filename, const LibraryIndexRecord & record );
+    void remove( const QString & filename );
+
+    static quint64 hashPath( const QString & filename );
+};
+
+#endif // LIBRARYINDEX_H
@@ -12,8 +12,53 @@
 #include <QNetworkRequest>
 #include <QCommandLineParser>
 
+#include <QElapsedTimer>
+#include <QTextStream>
+
 #include "version.h"
 #include "settings.h"
+#include "simulatedwatch.h"
+#include "watchrecorder.h"
+
+// reads every workout off the watch and reports the throughput.
+static int benchmarkDownload( TTWatch & watch )
+{
+    QTextStream out(stdout);
+
+    TTFileList fl;
+    if ( !watch.open() || !watch.listFiles(fl) )
+    {
+        out << "could not list the files on the watch\n";
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 bytes = 0;
+    int count = 0;
+    foreach ( const TTFile & file, fl )
+    {
+        if ( ( file.id & FILE_TYPE_MASK ) != FILE_TTBIN_DATA )
+        {
+            continue;
+        }
+
+        QByteArray data;
+        if ( !watch.readFile(data, file.id) )
+        {
+            out << "failed to read file " << QString::number(file.id, 16) << "\n";
+            return 1;
+        }
+        bytes += data.length();
+        count++;
+    }
+
+    double seconds = qMax<qint64>(1, timer.elapsed()) / 1000.0;
+    out << count << " workouts, " << bytes << " bytes in " << seconds << " s, "
+        << QString::number(bytes / 1024.0 / seconds, 'f', 1) << " KB/s\n";
+    watch.close();
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -34,8 +79,58 @@ int main(int argc, char *argv[])
 
     QCommandLineOption startHidden(QStringList() << "h" << "hidden", QCoreApplication::translate("main", "Startup in traybar with main window hidden."));
     parser.addOption(startHidden);
+
+    QCommandLineOption simulateWatch("simulate-watch", QCoreApplication::translate("main", "Add a simulated watch serving the workouts in <directory>."), "directory");
+    QCommandLineOption simulateLatency("simulate-latency", QCoreApplication::translate("main", "Latency of the simulated watch per report in microseconds."), "usecs", "0");
+    QCommandLineOption simulateFailures("simulate-failure-rate", QCoreApplication::translate("main", "Fraction of the commands the simulated watch does not answer."), "rate", "0");
+    QCommandLineOption replayWatch("replay-watch", QCoreApplication::translate("main", "Add a watch that replays the recorded session in <file>."), "file");
+    QCommandLineOption recordWatch("record-watch", QCoreApplication::translate("main", "Record the traffic of connected watches in <directory>."), "directory");
+    QCommandLineOption benchmark("benchmark-download", QCoreApplication::translate("main", "Download all workouts from the simulated or replayed watch, report the throughput and exit."));
+    parser.addOption(simulateWatch);
+    parser.addOption(simulateLatency);
+    parser.addOption(simulateFailures);
+    parser.addOption(replayWatch);
+    parser.addOption(recordWatch);
+    QCommandLineOption readWindow("read-window", QCoreApplication::translate("main", "Number of read commands kept in flight while downloading, 1 reads in lock-step."), "count");
+    parser.addOption(benchmark);
+    parser.addOption(readWindow);
     parser.process(a);
 
+    IWatchTransport * transport = 0;
+    QString transportPath;
+    if ( parser.isSet(simulateWatch) )
+    {
+        SimulatedWatchTransport * simulated = new SimulatedWatchTransport();
+        simulated->loadDirectory(parser.value(simulateWatch));
+        simulated->setLatency(parser.value(simulateLatency).toInt());
+        simulated->setFailureRate(parser.value(simulateFailures).toDouble());
+        transport = simulated;
+        transportPath = "simulated:" + parser.value(simulateWatch);
+    }
+    else if ( parser.isSet(replayWatch) )
+    {
+        ReplayWatchTransport * replay = new ReplayWatchTransport();
+        replay->load(parser.value(replayWatch));
+        replay->setRealTime(!parser.isSet(benchmark));
+        transport = replay;
+        transportPath = "replay:" + parser.value(replayWatch);
+    }
+
+    if ( parser.isSet(benchmark) )
+    {
+        if ( !transport )
+        {
+            QTextStream(stderr) << "--benchmark-download needs --simulate-watch or --replay-watch\n";
+            return 1;
+        }
+        TTWatch watch(transport, transportPath, "SIMULATED");
+        if ( parser.isSet(readWindow) )
+        {
+            watch.setReadWindow(parser.value(readWindow).toInt());
+        }
+        return benchmarkDownload(watch);
+    }
+
     Settings::get(); // create settings object.
 
     int result = 0;
@@ -44,6 +139,14 @@ int main(int argc, char *argv[])
         // scope this so that everything is gone and we can destroy
         // settings at the end.
         MainWindow w;
+        if ( parser.isSet(recordWatch) )
+        {
+            w.watchManager().setRecordDirectory(parser.value(recordWatch));
+        }
+        if ( transport )
+        {
+            w.watchManager().addWatch(new TTWatch(transport, transportPath, "SIMULATED"));
+        }
         QObject::connect(&a, SIGNAL(messageReceived(QString,QObject*)), &w, SLOT(onMessage(QString)));
         QObject::connect(&a, SIGNAL(commitDataRequest(QSessionManager&)), &w, SLOT(onCommitDataRequest(QSessionManager&)));
 
@@ -15,6 +15,8 @@
 #include <QMenu>
 #include <QEvent>
 #include <QIcon>
+#include <QFontMetrics>
+#include <QLocale>
 
 #include "exportworkingdialog.h"
 #include "flatfileiconprovider.h"
@@ -42,9 +44,35 @@ bool MainWindow::processTTBin(const QString& filename)
 
     ui->mapWidget->clearLines();
 
-    TTBinReader br;
+    // a recently opened workout is shown straight from the cache.
+    ActivityCacheEntry * cached = m_ActivityCache.find(filename);
+    if ( cached && cached->hasSeries && cached->elevation && cached->metric == m_Settings->useMetric() )
+    {
+        m_Activity = cached->activity;
+        m_Seconds = cached->seconds;
+        m_HeartBeat = cached->heartBeat;
+        m_Cadence = cached->cadence;
+        m_Speed = cached->speed;
+        m_Elevation = cached->elevationSeries;
+        ui->statusBar->showMessage(tr("Import done."));
+        showActivity();
+        return true;
+    }
 
-    ActivityPtr a = br.read(filename, true);
+    ActivityPtr a;
+    if ( cached )
+    {
+        a = cached->activity;
+    }
+    else
+    {
+        TTBinReader br;
+        a = br.read(filename, true);
+        if ( a )
+        {
+            m_ActivityCache.insert(filename, a);
+        }
+    }
     m_Activity = a;
 
     if ( !a )
@@ -53,6 +81,13 @@ bool MainWindow::processTTBin(const QString& filename)
         return false;
     }
 
+    if ( cached && cached->elevation )
+    {
+        // only the units changed, the elevation data is already there.
+        onElevationLoaded(true, a);
+        return true;
+    }
+
     ui->statusBar->showMessage(tr("Loading Elevation Data..."));
     m_ElevationLoader.load(a);
     return true;
@@ -75,14 +110,31 @@ void MainWindow::onElevationLoaded(bool success, ActivityPtr activity)
         ui->statusBar->showMessage(tr("Import done."));
     }
 
-    QRectF bounds;
-    bool firstBounds = true;
+    calcSeries(success);
 
-    double lastHeart =0;
+    // the entry was made when the activity was opened, it is only updated here.
+    ActivityCacheEntry * cached = m_ActivityCache.peek(m_Activity->filename());
+    if ( cached && cached->activity == m_Activity )
+    {
+        cached->hasSeries = true;
+        cached->elevation = success;
+        cached->metric = m_Settings->useMetric();
+        cached->seconds = m_Seconds;
+        cached->heartBeat = m_HeartBeat;
+        cached->cadence = m_Cadence;
+        cached->speed = m_Speed;
+        cached->elevationSeries = m_Elevation;
+        m_ActivityCache.update(m_Activity->filename());
+    }
 
-    ui->mapWidget->clearLines();
-    ui->graph->clearGraphs();
+    showActivity();
+}
 
+void MainWindow::calcSeries(bool elevation)
+{
+    m_Seconds.clear();
+
+    double lastHeart =0;
     quint64 firstTime = 0;
 
     CenteredExpMovAvg cadence(61, 0.95);
@@ -90,8 +142,6 @@ void MainWindow::onElevationLoaded(bool success, ActivityPtr activity)
     CenteredExpMovAvg heartBeat(31, 0.95);
     CenteredExpMovAvg altitude(61, 0.95);
 
-    TrackPointPtr prev;
-
     foreach( LapPtr lap, m_Activity->laps())
     {
 
@@ -102,50 +152,15 @@ void MainWindow::onElevationLoaded(bool success, ActivityPtr activity)
                 continue;
             }
 
-            if ( firstBounds )
-            {
-                firstBounds = false;
-                bounds.setTop(tp->latitude());
-                bounds.setLeft(tp->longitude());
-                bounds.setBottom(tp->latitude());
-                bounds.setRight(tp->longitude());
-            }
-
-            if ( tp->latitude() < bounds.bottom() )
+            if ( firstTime == 0 )
             {
-                bounds.setBottom(tp->latitude());
-            }
-            else if ( tp->latitude() > bounds.top() )
-            {
-                bounds.setTop( tp->latitude());
-            }
-
-            if ( tp->longitude() < bounds.left() )
-            {
-                bounds.setLeft(tp->longitude());
-            }
-            else if ( tp->longitude() > bounds.right() )
-            {
-                bounds.setRight( tp->longitude() );
-            }
-
-
-
-
-            if (!prev && firstTime == 0 )
-            {
-                prev = tp;
                 firstTime = tp->time().toTime_t();
                 continue;
             }
 
-
-            ui->mapWidget->addLine(prev->latitude(), prev->longitude(),tp->latitude(),tp->longitude());
-            prev = tp;
-
             m_Seconds.append( tp->time().toTime_t() - firstTime );
 
-            if ( success )
+            if ( elevation )
             {
                 if ( m_Settings->useMetric() )
                 {
@@ -230,12 +245,68 @@ void MainWindow::onElevationLoaded(bool success, ActivityPtr activity)
     {
         m_Cadence.append( cadence.cea(i));
         m_HeartBeat.append( heartBeat.cea(i));
-        if ( success )
+        if ( elevation )
         {
             m_Elevation.append( altitude.cea(i));
         }
         m_Speed.append( speed.cea(i));
     }
+}
+
+void MainWindow::showActivity()
+{
+    QRectF bounds;
+    bool firstBounds = true;
+
+    ui->mapWidget->clearLines();
+    ui->graph->clearGraphs();
+    m_Cursor->setVisible(false);
+
+    TrackPointPtr prev;
+
+    foreach( LapPtr lap, m_Activity->laps())
+    {
+        foreach ( TrackPointPtr tp, lap->points())
+        {
+            if ( tp->latitude() ==0 && tp->longitude() == 0 )
+            {
+                continue;
+            }
+
+            if ( firstBounds )
+            {
+                firstBounds = false;
+                bounds.setTop(tp->latitude());
+                bounds.setLeft(tp->longitude());
+                bounds.setBottom(tp->latitude());
+                bounds.setRight(tp->longitude());
+            }
+
+            if ( tp->latitude() < bounds.bottom() )
+            {
+                bounds.setBottom(tp->latitude());
+            }
+            else if ( tp->latitude() > bounds.top() )
+            {
+                bounds.setTop( tp->latitude());
+            }
+
+            if ( tp->longitude() < bounds.left() )
+            {
+                bounds.setLeft(tp->longitude());
+            }
+            else if ( tp->longitude() > bounds.right() )
+            {
+                bounds.setRight( tp->longitude() );
+            }
+
+            if ( prev )
+            {
+                ui->mapWidget->addLine(prev->latitude(), prev->longitude(),tp->latitude(),tp->longitude());
+            }
+            prev = tp;
+        }
+    }
 
     if ( m_Axis3 == 0 )
     {
@@ -343,6 +414,11 @@ void MainWindow::onElevationLoaded(bool success, ActivityPtr activity)
 
 
 
+TTManager &MainWindow::watchManager()
+{
+    return m_TTManager;
+}
+
 void MainWindow::dragEnterEvent(QDragEnterEvent *e)
 {
     if ( !e->mimeData()->hasUrls())
@@ -405,17 +481,16 @@ void MainWindow::download(bool manualDownload)
 
     if ( dd->processWatches(manualDownload) == QDialog::Accepted )
     {
-        m_WorkoutTreeModel.rescan(false);
         QStringList files = dd->filesDownloaded();
+        m_WorkoutTreeModel.refresh(files);
         if ( files.count() > 0 )
         {
             QModelIndex index = m_WorkoutTreeModel.findWorkoutItem( files.first());
             if ( index.isValid() )
             {
-                QModelIndex proxyIndex = m_WorkoutSortingFilter.mapFromSource( index ) ;
-                ui->treeView->scrollTo( proxyIndex );
-                ui->treeView->setCurrentIndex(proxyIndex);
-                on_treeView_clicked(proxyIndex);
+                ui->treeView->scrollTo( index );
+                ui->treeView->setCurrentIndex(index);
+                on_treeView_clicked(index);
             }
         }
     }
@@ -439,6 +514,7 @@ MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     m_Axis3(0),
     m_Axis4(0),
+    m_Cursor(0),
     m_Settings( Settings::get() ),
     m_WorkoutTreeModel(m_Settings->ttdir()),
     m_MayClose(false),
@@ -453,6 +529,19 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->actionShow_Heart_Rate->setChecked(true);
     ui->actionShow_Speed->setChecked(true);
 
+    // The cursor lives on its own buffered layer on top, so following the mouse only redraws
+    // that layer instead of replotting all graphs.
+    ui->graph->addLayer("cursor", ui->graph->layer("legend"), QCustomPlot::limAbove);
+    ui->graph->layer("cursor")->setMode(QCPLayer::lmBuffered);
+    m_Cursor = new QCPItemStraightLine(ui->graph);
+    ui->graph->addItem(m_Cursor);
+    m_Cursor->setLayer("cursor");
+    m_Cursor->setSelectable(false);
+    m_Cursor->setPen(QPen(Qt::gray, 0, Qt::DashLine));
+    m_Cursor->point1->setTypeY(QCPItemPosition::ptAxisRectRatio);
+    m_Cursor->point2->setTypeY(QCPItemPosition::ptAxisRectRatio);
+    m_Cursor->setVisible(false);
+
     connect(ui->graph, SIGNAL(mouseMove(QMouseEvent*)), this, SLOT(onGraphMouseMove(QMouseEvent*)));
     connect(&m_TTManager, SIGNAL(ttArrived(QString)), this, SLOT(onWatchArrived()));
     connect(&m_ElevationLoader, SIGNAL(loaded(bool,ActivityPtr)), this, SLOT(onElevationLoaded(bool,ActivityPtr)));
@@ -463,20 +552,36 @@ MainWindow::MainWindow(QWidget *parent) :
 
     m_TTManager.startSearch();
 
-    m_WorkoutSortingFilter.setSortRole(Qt::UserRole);
-    m_WorkoutSortingFilter.setSourceModel(&m_WorkoutTreeModel);
-    ui->treeView->setModel( & m_WorkoutSortingFilter );
+    // the model sorts and filters on its own indexes, no proxy in between.
+    ui->treeView->setModel( & m_WorkoutTreeModel );
+    // the library is scanned in the background, expand watches as they show up.
+    connect(&m_WorkoutTreeModel, SIGNAL(rowsInserted(QModelIndex,int,int)), this, SLOT(onWorkoutRowsInserted(QModelIndex,int,int)));
+    connect(&m_WorkoutTreeModel, SIGNAL(modelReset()), this, SLOT(onWorkoutModelReset()));
     ui->treeView->sortByColumn(0,Qt::DescendingOrder);
-    ui->treeView->expandAll();
-    ui->treeView->resizeColumnToContents(0);
-    ui->treeView->resizeColumnToContents(1);
-    ui->treeView->resizeColumnToContents(2);
-    ui->treeView->resizeColumnToContents(3);
+    ui->treeView->setUniformRowHeights(true);
+    sizeWorkoutColumns();
 
     m_TileCombo = new QComboBox;
     ui->toolBar->addSeparator();
     ui->toolBar->addWidget( m_TileCombo );
 
+    m_PeriodCombo = new QComboBox;
+    m_PeriodCombo->addItem(tr("All workouts"), 0);
+    m_PeriodCombo->addItem(tr("Last 7 days"), 7);
+    m_PeriodCombo->addItem(tr("Last 30 days"), 30);
+    m_PeriodCombo->addItem(tr("Last 365 days"), 365);
+    m_SportCombo = new QComboBox;
+    m_SportCombo->addItem(tr("All sports"), -1);
+    for (int i=(int)Activity::RUNNING;i<=(int)Activity::OTHER;i++)
+    {
+        m_SportCombo->addItem(Activity::sportToString((Activity::Sport)i), i);
+    }
+    ui->toolBar->addSeparator();
+    ui->toolBar->addWidget( m_PeriodCombo );
+    ui->toolBar->addWidget( m_SportCombo );
+    connect(m_PeriodCombo, SIGNAL(currentIndexChanged(int)), this, SLOT(onWorkoutFilterChanged()));
+    connect(m_SportCombo, SIGNAL(currentIndexChanged(int)), this, SLOT(onWorkoutFilterChanged()));
+
 
     int tileIndex = 0;
     int tileSelectIndex = -1;
@@ -736,11 +841,14 @@ void MainWindow::onGraphMouseMove(QMouseEvent *event)
 
     if ( pos < 0 )
     {
+        moveGraphCursor(0, false);
         return;
     }
 
     TrackPointPtr pt = m_Activity->find( pos );
 
+    moveGraphCursor(pos, !pt.isNull());
+
     if ( pt )
     {
         int cadence = 0;
@@ -763,6 +871,84 @@ void MainWindow::onGraphMouseMove(QMouseEvent *event)
 
 
 
+void MainWindow::onWorkoutModelReset()
+{
+    onWorkoutRowsInserted(QModelIndex(), 0, m_WorkoutTreeModel.rowCount(QModelIndex()) - 1);
+}
+
+void MainWindow::onWorkoutFilterChanged()
+{
+    WorkoutFilter filter;
+
+    int days = m_PeriodCombo->currentData().toInt();
+    if ( days > 0 )
+    {
+        filter.from = QDateTime(QDate::currentDate().addDays(-days), QTime(0,0,0));
+    }
+
+    int sport = m_SportCombo->currentData().toInt();
+    if ( sport >= 0 )
+    {
+        filter.sports.insert(sport);
+    }
+
+    m_WorkoutTreeModel.setFilter(filter);
+}
+
+void MainWindow::sizeWorkoutColumns()
+{
+    // estimate the column widths from the widest text a column can show, measuring
+    // every row with resizeColumnToContents does not scale to large libraries.
+    QFontMetrics fm(ui->treeView->font());
+    int margin = fm.width("MM");
+
+    QList<QStringList> samples;
+    samples << ( QStringList() << QLocale().toString(QDateTime(QDate(2000, 12, 28), QTime(23, 59, 59)), QLocale::ShortFormat) )
+            << ( QStringList() << "00:00:00" )
+            << ( QStringList() << "9999.99 K" << "9999 yd" << "9999.99 M" )
+            << ( QStringList() << "99.99 min/Km" << "99.99 Km/hr" << "99.99 min/M" << "99.99 Mph" );
+
+    for ( int column = 0; column < samples.count(); column++ )
+    {
+        int width = 0;
+        foreach ( const QString & sample, samples.at(column) )
+        {
+            width = qMax(width, fm.width(sample));
+        }
+        if ( column == 0 )
+        {
+            width += ui->treeView->indentation();
+        }
+        ui->treeView->setColumnWidth(column, width + margin);
+    }
+}
+
+void MainWindow::onWorkoutRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    if ( parent.isValid() )
+    {
+        return;
+    }
+
+    for ( int row = first; row <= last; row++ )
+    {
+        ui->treeView->expand( m_WorkoutTreeModel.index(row, 0, QModelIndex()) );
+    }
+}
+
+void MainWindow::moveGraphCursor(double pos, bool visible)
+{
+    if ( !visible && !m_Cursor->visible() )
+    {
+        return;
+    }
+
+    m_Cursor->point1->setCoords(pos, 0);
+    m_Cursor->point2->setCoords(pos, 1);
+    m_Cursor->setVisible(visible);
+    m_Cursor->layer()->replot();
+}
+
 void MainWindow::on_actionProcess_TTBIN_triggered()
 {
     static QString dir;
@@ -796,9 +982,7 @@ void MainWindow::on_treeView_clicked(const QModelIndex &index)
         return;
     }
 
-    QModelIndex sourceIndex = m_WorkoutSortingFilter.mapToSource(index);
-
-    TTWorkoutItem * item = m_WorkoutTreeModel.indexToWorkoutItem(sourceIndex);
+    TTWorkoutItem * item = m_WorkoutTreeModel.indexToWorkoutItem(index);
     if ( item == 0 )
     {
         return;
@@ -842,10 +1026,8 @@ void MainWindow::on_actionShow_in_explorer_triggered()
     {
         return;
     }
-    QModelIndex sourceIndex = m_WorkoutSortingFilter.mapToSource(index);
-
     // if user selected a workout point to that otherwise just open TT directory.
-    TTWorkoutItem * item = m_WorkoutTreeModel.indexToWorkoutItem(sourceIndex);
+    TTWorkoutItem * item = m_WorkoutTreeModel.indexToWorkoutItem(index);
     if ( item != 0 )
     {
         filename = item->filename();
@@ -946,8 +1128,7 @@ void MainWindow::on_actionChange_Activity_Type_triggered()
         return;
     }
 
-    QModelIndex sourceIndex = m_WorkoutSortingFilter.mapToSource(index);
-    TTWorkoutItem * item = m_WorkoutTreeModel.indexToWorkoutItem(sourceIndex);
+    TTWorkoutItem * item = m_WorkoutTreeModel.indexToWorkoutItem(index);
     if ( !item )
     {
         return;
@@ -1010,7 +1191,7 @@ void MainWindow::on_actionChange_Activity_Type_triggered()
     output.close();
     input.rename( item->filename() + ".backup");
     output.rename( item->filename() );
-    if ( !m_WorkoutTreeModel.reloadIndex(sourceIndex) )
+    if ( !m_WorkoutTreeModel.reloadIndex(index) )
     {
         output.remove();
         input.rename( item->filename() );
@@ -5,7 +5,6 @@
 #include <QFileSystemModel>
 #include <QTimer>
 #include <QAbstractNativeEventFilter>
-#include <QSortFilterProxyModel>
 #include <QSystemTrayIcon>
 
 #include "ttmanager.h"
@@ -14,6 +13,7 @@
 #include "elevationloader.h"
 #include "settings.h"
 #include "workouttreemodel.h"
+#include "activitycache.h"
 
 namespace Ui {
 class MainWindow;
@@ -30,16 +30,21 @@ class MainWindow : public QMainWindow, public QAbstractNativeEventFilter
     QVector<double> m_Speed;
     QVector<double> m_Elevation;
     bool processTTBin(const QString& filename);    
+    void calcSeries(bool elevation);
+    void showActivity();
+    ActivityCache m_ActivityCache;
     QFileSystemModel * m_FSModel;
     QCPAxis * m_Axis3;
     QCPAxis * m_Axis4;
+    QCPItemStraightLine * m_Cursor;
     ElevationLoader m_ElevationLoader;
     QComboBox * m_TileCombo;
+    QComboBox * m_PeriodCombo;
+    QComboBox * m_SportCombo;
     Settings * m_Settings;
     QTimer m_WatchTimer;
     QTimer m_DeviceArriveDebounce;
     WorkoutTreeModel m_WorkoutTreeModel;
-    QSortFilterProxyModel m_WorkoutSortingFilter;
     bool m_MayClose;
     QSystemTrayIcon * m_TrayIcon;
 
@@ -47,12 +52,15 @@ class MainWindow : public QMainWindow, public QAbstractNativeEventFilter
     void dropEvent(QDropEvent *e);
     void download(bool manualDownload);
     void closeEvent (QCloseEvent *event);
+    void moveGraphCursor(double pos, bool visible);
+    void sizeWorkoutColumns();
 
 public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
 
     virtual bool nativeEventFilter(const QByteArray &eventType, void *message, long *l);
+    TTManager & watchManager();
 public slots:
     void onMessage(QString messageReceived);
     void onCommitDataRequest(QSessionManager & manager);
@@ -72,6 +80,10 @@ private slots:
 
     void onGraphMouseMove(QMouseEvent * event);
 
+    void onWorkoutRowsInserted(const QModelIndex & parent, int first, int last);
+    void onWorkoutModelReset();
+    void onWorkoutFilterChanged();
+
     void on_actionProcess_TTBIN_triggered();
 
     void on_actionExit_triggered();    
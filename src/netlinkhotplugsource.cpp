@@ -0,0 +1,125 @@
+#include "netlinkhotplugsource.h"
+
+#include <QSocketNotifier>
+#include <QList>
+#include <QDebug>
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#define UEVENT_BUFFER_SIZE 8192
+#define UEVENT_KERNEL_GROUP 1
+
+NetlinkHotplugSource::NetlinkHotplugSource(quint16 vendorId, QObject *parent) :
+    IHotplugSource(parent),
+    m_VendorId(vendorId),
+    m_Socket(-1),
+    m_Notifier(0)
+{
+}
+
+NetlinkHotplugSource::~NetlinkHotplugSource()
+{
+    delete m_Notifier;
+    if ( m_Socket >= 0 )
+    {
+        ::close(m_Socket);
+    }
+}
+
+bool NetlinkHotplugSource::start()
+{
+    if ( m_Socket >= 0 )
+    {
+        return true;
+    }
+
+    m_Socket = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if ( m_Socket < 0 )
+    {
+        qWarning() << "NetlinkHotplugSource::start / could not create netlink socket " << strerror(errno);
+        return false;
+    }
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = UEVENT_KERNEL_GROUP;
+    if ( ::bind(m_Socket, (struct sockaddr*)&addr, sizeof(addr)) < 0 )
+    {
+        qWarning() << "NetlinkHotplugSource::start / could not bind netlink socket " << strerror(errno);
+        ::close(m_Socket);
+        m_Socket = -1;
+        return false;
+    }
+
+    m_Notifier = new QSocketNotifier(m_Socket, QSocketNotifier::Read, this);
+    connect(m_Notifier, SIGNAL(activated(int)), this, SLOT(onActivated()));
+    return true;
+}
+
+// a uevent is "action@devpath" followed by KEY=value pairs, all 0 terminated.
+// The USB device itself carries PRODUCT=vid/pid/bcd in hex without leading zeros.
+bool NetlinkHotplugSource::matches(const QByteArray &message) const
+{
+    QList<QByteArray> fields = message.split('\0');
+    if ( fields.isEmpty() || !fields.first().contains('@') )
+    {
+        return false;
+    }
+
+    QByteArray action = fields.first().left( fields.first().indexOf('@') );
+    if ( action != "add" && action != "remove" )
+    {
+        return false;
+    }
+
+    bool usb = false;
+    bool vendor = false;
+    QByteArray product = "PRODUCT=" + QByteArray::number(m_VendorId, 16) + "/";
+    foreach ( const QByteArray & field, fields )
+    {
+        if ( field == "SUBSYSTEM=usb" )
+        {
+            usb = true;
+        }
+        else if ( field.startsWith(product) )
+        {
+            vendor = true;
+        }
+    }
+    return usb && vendor;
+}
+
+void NetlinkHotplugSource::onActivated()
+{
+    char buffer[UEVENT_BUFFER_SIZE];
+    bool changed = false;
+
+    // one add or remove comes with a burst of uevents, read them all.
+    for ( ;; )
+    {
+        struct sockaddr_nl sender;
+        socklen_t senderLen = sizeof(sender);
+        ssize_t len = ::recvfrom(m_Socket, buffer, sizeof(buffer), 0, (struct sockaddr*)&sender, &senderLen);
+        if ( len <= 0 )
+        {
+            break;
+        }
+
+        // only the kernel itself sends from port 0, ignore anybody else.
+        if ( sender.nl_pid == 0 && matches( QByteArray(buffer, len) ) )
+        {
+            changed = true;
+        }
+    }
+
+    if ( changed )
+    {
+        qDebug() << "NetlinkHotplugSource::onActivated / USB devices of vendor " << hex << m_VendorId << " changed.";
+        emit devicesChanged();
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef NETLINKHOTPLUGSOURCE_H
+#define NETLINKHOTPLUGSOURCE_H
+
+#include "ihotplugsource.h"
+
+class QSocketNotifier;
+
+// Listens to the uevents the kernel broadcasts on its netlink socket, the same
+// ones udev gets, and reports USB devices of one vendor coming and going.
+// Needs neither udev nor any privileges.
+class NetlinkHotplugSource : public IHotplugSource
+{
+    Q_OBJECT
+    quint16 m_VendorId;
+    int m_Socket;
+    QSocketNotifier * m_Notifier;
+
+    bool matches( const QByteArray & message ) const;
+
+public:
+    explicit NetlinkHotplugSource( quint16 vendorId, QObject * parent = 0 );
+    ~NetlinkHotplugSource();
+
+    bool start();
+
+private slots:
+    void onActivated();
+};
+
+#endif // NETLINKHOTPLUGSOURCE_H
@@ -0,0 +1,173 @@
+#include "partialdownload.h"
+
+#include <QDataStream>
+#include <QSaveFile>
+#include <QDebug>
+
+#define CHECKPOINT_MAGIC 0x54545044 // "TTPD"
+#define CHECKPOINT_VERSION 1
+
+PartialDownload::PartialDownload(const QString &target, quint32 fileId, quint32 length) :
+    m_Target(target),
+    m_FileId(fileId),
+    m_Length(length),
+    m_Done(0),
+    m_File(partialFilename(target))
+{
+}
+
+PartialDownload::~PartialDownload()
+{
+    m_File.close();
+}
+
+QString PartialDownload::partialFilename(const QString &target)
+{
+    return target + ".partial";
+}
+
+QString PartialDownload::checkpointFilename(const QString &target)
+{
+    return target + ".checkpoint";
+}
+
+bool PartialDownload::open()
+{
+    m_Done = 0;
+
+    QFile checkpoint(checkpointFilename(m_Target));
+    if ( checkpoint.open(QIODevice::ReadOnly) )
+    {
+        QDataStream ds(&checkpoint);
+        quint32 magic, fileId, length, done;
+        quint8 version;
+        ds >> magic >> version >> fileId >> length >> done;
+
+        if ( ds.status() == QDataStream::Ok && magic == CHECKPOINT_MAGIC && version == CHECKPOINT_VERSION &&
+             fileId == m_FileId && length == m_Length && done <= length && m_File.size() >= done )
+        {
+            m_Done = done;
+        }
+    }
+
+    if ( !m_File.open(QIODevice::ReadWrite) )
+    {
+        qWarning() << "PartialDownload::open / could not open " << m_File.fileName() << m_File.errorString();
+        return false;
+    }
+
+    // anything past the checkpoint may not have made it to disk completely.
+    if ( !m_File.resize(m_Done) || !m_File.seek(m_Done) )
+    {
+        qWarning() << "PartialDownload::open / could not truncate " << m_File.fileName();
+        return false;
+    }
+
+    if ( m_Done > 0 )
+    {
+        qDebug() << "PartialDownload::open / resuming " << m_Target << " at " << m_Done << " of " << m_Length;
+    }
+    return true;
+}
+
+quint32 PartialDownload::done() const
+{
+    return m_Done;
+}
+
+bool PartialDownload::saveCheckpoint()
+{
+    QSaveFile f(checkpointFilename(m_Target));
+    if ( !f.open(QIODevice::WriteOnly) )
+    {
+        qWarning() << "PartialDownload::saveCheckpoint / could not write " << f.fileName() << f.errorString();
+        return false;
+    }
+
+    QDataStream ds(&f);
+    ds << quint32(CHECKPOINT_MAGIC) << quint8(CHECKPOINT_VERSION) << m_FileId << m_Length << m_Done;
+    return f.commit();
+}
+
+bool PartialDownload::restart()
+{
+    m_Done = 0;
+    return m_File.resize(0) && m_File.seek(0) && saveCheckpoint();
+}
+
+bool PartialDownload::receive(quint32 pos, const QByteArray &data)
+{
+    if ( pos > m_Done )
+    {
+        qWarning() << "PartialDownload::receive / gap in " << m_File.fileName() << " at " << m_Done << pos;
+        return false;
+    }
+
+    quint32 end = qMin( pos + (quint32)data.length(), m_Length );
+
+    if ( pos < m_Done )
+    {
+        quint32 count = qMin(m_Done, end) - pos;
+        m_File.seek(pos);
+        QByteArray stored = m_File.read(count);
+        m_File.seek(m_Done);
+
+        if ( stored != data.left(count) )
+        {
+            // the earlier bytes went by already, the next attempt starts clean.
+            qWarning() << "PartialDownload::receive / watch data differs from " << m_File.fileName() << ", starting over.";
+            restart();
+            return false;
+        }
+    }
+
+    if ( end <= m_Done )
+    {
+        return true;
+    }
+
+    // the data has to be on disk before the checkpoint claims it.
+    quint32 count = end - m_Done;
+    if ( m_File.write(data.constData() + ( m_Done - pos ), count) != (qint64)count || !m_File.flush() )
+    {
+        qWarning() << "PartialDownload::receive / could not write " << m_File.fileName() << m_File.errorString();
+        return false;
+    }
+    m_Done = end;
+    return saveCheckpoint();
+}
+
+bool PartialDownload::commit()
+{
+    if ( m_Done != m_Length )
+    {
+        qWarning() << "PartialDownload::commit / incomplete " << m_File.fileName() << m_Done << " of " << m_Length;
+        return false;
+    }
+
+    m_File.seek(0);
+    QByteArray header = m_File.read(2);
+    if ( header.length() < 2 || !( (quint8)header[0] == 0x20 && (quint8)header[1] >= 0x05 ) )
+    {
+        qWarning() << "PartialDownload::commit / not a ttbin file " << m_File.fileName();
+        return false;
+    }
+    m_File.close();
+
+    QFile::remove(m_Target);
+    if ( !QFile::rename(m_File.fileName(), m_Target) )
+    {
+        qWarning() << "PartialDownload::commit / could not rename " << m_File.fileName() << " to " << m_Target;
+        return false;
+    }
+    QFile::remove(checkpointFilename(m_Target));
+    return true;
+}
+
+void PartialDownload::discard()
+{
+    m_File.close();
+    m_File.remove();
+    QFile::remove(checkpointFilename(m_Target));
+    m_Done = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef PARTIALDOWNLOAD_H
+#define PARTIALDOWNLOAD_H
+
+#include <QString>
+#include <QByteArray>
+#include <QFile>
+
+// A workout on its way from the watch. Received data goes to <target>.partial
+// and <target>.checkpoint records the file id, its length and how many bytes
+// are confirmed on disk, so an interrupted download carries on from there the
+// next time the watch is connected. The watch can not seek within a file, the
+// confirmed bytes come in again and are compared instead of written.
+class PartialDownload
+{
+    QString m_Target;
+    quint32 m_FileId;
+    quint32 m_Length;
+    quint32 m_Done; // bytes in the partial file covered by the checkpoint
+    QFile m_File;
+
+    bool saveCheckpoint();
+    bool restart();
+
+public:
+    PartialDownload( const QString & target, quint32 fileId, quint32 length );
+    ~PartialDownload();
+
+    static QString partialFilename( const QString & target );
+    static QString checkpointFilename( const QString & target );
+
+    // picks up an earlier attempt when its checkpoint matches, starts empty otherwise.
+    bool open();
+    quint32 done() const;
+
+    // data holds the bytes of the file from pos on, as they come from the
+    // watch. Bytes an earlier attempt stored are checked against it, the rest
+    // is appended and checkpointed.
+    bool receive( quint32 pos, const QByteArray & data );
+
+    // checks the complete file and renames it to the target.
+    bool commit();
+    void discard();
+};
+
+#endif // PARTIALDOWNLOAD_H
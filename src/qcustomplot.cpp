@@ -25,6 +25,8 @@
 
 #include "qcustomplot.h"
 
+#include <algorithm>
+
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -719,6 +721,12 @@ void QCPScatterStyle::drawShape(QCPPainter *painter, double x, double y) const
   
   When a layer is deleted, the objects on it are not deleted with it, but fall on the layer below
   the deleted layer, see QCustomPlot::removeLayer.
+  
+  By default all layers are logical layers (\ref lmLogical) which are rendered together into one
+  paint buffer. A layer whose contents change much more often than the rest of the plot, e.g. a
+  cursor following the mouse, can be switched to \ref lmBuffered with \ref setMode. It then gets
+  its own paint buffer and can be redrawn on its own with \ref replot, while the cached buffers of
+  the other layers are simply composited again.
 */
 
 /* start documentation of inline functions */
@@ -752,7 +760,9 @@ QCPLayer::QCPLayer(QCustomPlot *parentPlot, const QString &layerName) :
   mParentPlot(parentPlot),
   mName(layerName),
   mIndex(-1), // will be set to a proper value by the QCustomPlot layer creation function
-  mVisible(true)
+  mVisible(true),
+  mMode(lmLogical),
+  mPaintBufferIndex(-1) // will be assigned by QCustomPlot::setupPaintBuffers
 {
   // Note: no need to make sure layerName is unique, because layer
   // management is done with QCustomPlot functions.
@@ -785,6 +795,52 @@ void QCPLayer::setVisible(bool visible)
   mVisible = visible;
 }
 
+/*!
+  Sets how this layer is rendered. A layer in \ref lmBuffered mode is drawn into a paint buffer of
+  its own, so it can be updated with \ref replot without redrawing the rest of the plot.
+  
+  Changing the mode causes the paint buffers to be set up again on the next \ref
+  QCustomPlot::replot.
+*/
+void QCPLayer::setMode(QCPLayer::LayerMode mode)
+{
+  if (mMode != mode)
+  {
+    mMode = mode;
+    mParentPlot->mPaintBuffersDirty = true;
+  }
+}
+
+/*!
+  Redraws only the layerables of this layer and updates the widget surface.
+  
+  This is only possible for layers in \ref lmBuffered mode whose paint buffer is up to date. In all
+  other cases a full \ref QCustomPlot::replot is performed instead.
+*/
+void QCPLayer::replot()
+{
+  if (mParentPlot->mReplotting)
+    return;
+  
+  if (mMode == lmBuffered && !mParentPlot->mPaintBuffersDirty &&
+      mPaintBufferIndex > 0 && mPaintBufferIndex < mParentPlot->mPaintBuffers.size())
+  {
+    QPixmap &buffer = mParentPlot->mPaintBuffers[mPaintBufferIndex];
+    buffer.fill(Qt::transparent);
+    QCPPainter painter;
+    painter.begin(&buffer);
+    if (painter.isActive())
+    {
+      painter.setRenderHint(QPainter::HighQualityAntialiasing);
+      draw(&painter);
+      painter.end();
+      mParentPlot->update();
+    } else
+      qDebug() << Q_FUNC_INFO << "Couldn't activate painter on layer buffer";
+  } else
+    mParentPlot->replot();
+}
+
 /*! \internal
   
   Adds the \a layerable to the list of this layer. If \a prepend is set to true, the layerable will
@@ -822,6 +878,25 @@ void QCPLayer::removeChild(QCPLayerable *layerable)
     qDebug() << Q_FUNC_INFO << "layerable is not child of this layer" << reinterpret_cast<quintptr>(layerable);
 }
 
+/*! \internal
+  
+  Draws all visible layerables of this layer with the provided \a painter, in rendering order.
+*/
+void QCPLayer::draw(QCPPainter *painter)
+{
+  foreach (QCPLayerable *child, mChildren)
+  {
+    if (child->realVisibility())
+    {
+      painter->save();
+      painter->setClipRect(child->clipRect().translated(0, -1));
+      child->applyDefaultAntialiasingHint(painter);
+      child->draw(painter);
+      painter->restore();
+    }
+  }
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////// QCPLayerable
@@ -9051,7 +9126,7 @@ QCustomPlot::QCustomPlot(QWidget *parent) :
   mCurrentLayer(0),
   mPlottingHints(QCP::phCacheLabels|QCP::phForceRepaint),
   mMultiSelectModifier(Qt::ControlModifier),
-  mPaintBuffer(size()),
+  mPaintBuffersDirty(true),
   mMouseEventElement(0),
   mReplotting(false)
 {
@@ -10115,6 +10190,7 @@ bool QCustomPlot::addLayer(const QString &name, QCPLayer *otherLayer, QCustomPlo
   QCPLayer *newLayer = new QCPLayer(this, name);
   mLayers.insert(otherLayer->index() + (insertMode==limAbove ? 1:0), newLayer);
   updateLayerIndices();
+  mPaintBuffersDirty = true;
   return true;
 }
 
@@ -10166,6 +10242,7 @@ bool QCustomPlot::removeLayer(QCPLayer *layer)
   delete layer;
   mLayers.removeOne(layer);
   updateLayerIndices();
+  mPaintBuffersDirty = true;
   return true;
 }
 
@@ -10193,6 +10270,7 @@ bool QCustomPlot::moveLayer(QCPLayer *layer, QCPLayer *otherLayer, QCustomPlot::
   
   mLayers.move(layer->index(), otherLayer->index() + (insertMode==limAbove ? 1:0));
   updateLayerIndices();
+  mPaintBuffersDirty = true;
   return true;
 }
 
@@ -10383,21 +10461,47 @@ void QCustomPlot::replot(QCustomPlot::RefreshPriority refreshPriority)
   mReplotting = true;
   emit beforeReplot();
   
-  mPaintBuffer.fill(mBackgroundBrush.style() == Qt::SolidPattern ? mBackgroundBrush.color() : Qt::transparent);
-  QCPPainter painter;
-  painter.begin(&mPaintBuffer);
-  if (painter.isActive())
+  if (mPaintBuffersDirty)
+    setupPaintBuffers();
+  updateLayout();
+  
+  bool painted = true;
+  for (int bufferIndex=0; bufferIndex<mPaintBuffers.size(); ++bufferIndex)
   {
+    QPixmap &buffer = mPaintBuffers[bufferIndex];
+    if (bufferIndex == 0)
+      buffer.fill(mBackgroundBrush.style() == Qt::SolidPattern ? mBackgroundBrush.color() : Qt::transparent);
+    else
+      buffer.fill(Qt::transparent);
+    QCPPainter painter;
+    painter.begin(&buffer);
+    if (!painter.isActive()) // might happen if QCustomPlot has width or height zero
+    {
+      painted = false;
+      break;
+    }
     painter.setRenderHint(QPainter::HighQualityAntialiasing); // to make Antialiasing look good if using the OpenGL graphicssystem
-    if (mBackgroundBrush.style() != Qt::SolidPattern && mBackgroundBrush.style() != Qt::NoBrush)
-      painter.fillRect(mViewport, mBackgroundBrush);
-    draw(&painter);
+    if (bufferIndex == 0)
+    {
+      if (mBackgroundBrush.style() != Qt::SolidPattern && mBackgroundBrush.style() != Qt::NoBrush)
+        painter.fillRect(mViewport, mBackgroundBrush);
+      drawBackground(&painter);
+    }
+    foreach (QCPLayer *layer, mLayers)
+    {
+      if (layer->mPaintBufferIndex == bufferIndex)
+        layer->draw(&painter);
+    }
     painter.end();
+  }
+  
+  if (painted)
+  {
     if ((refreshPriority == rpHint && mPlottingHints.testFlag(QCP::phForceRepaint)) || refreshPriority==rpImmediate)
       repaint();
     else
       update();
-  } else // might happen if QCustomPlot has width or height zero
+  } else
     qDebug() << Q_FUNC_INFO << "Couldn't activate painter on buffer. This usually happens because QCustomPlot has width or height zero.";
   
   emit afterReplot();
@@ -10669,19 +10773,21 @@ void QCustomPlot::paintEvent(QPaintEvent *event)
 {
   Q_UNUSED(event);
   QPainter painter(this);
-  painter.drawPixmap(0, 0, mPaintBuffer);
+  foreach (const QPixmap &buffer, mPaintBuffers)
+    painter.drawPixmap(0, 0, buffer);
 }
 
 /*! \internal
   
-  Event handler for a resize of the QCustomPlot widget. Causes the internal buffer to be resized to
+  Event handler for a resize of the QCustomPlot widget. Causes the internal buffers to be resized to
   the new size. The viewport (which becomes the outer rect of mPlotLayout) is resized
   appropriately. Finally a \ref replot is performed.
 */
 void QCustomPlot::resizeEvent(QResizeEvent *event)
 {
-  // resize and repaint the buffer:
-  mPaintBuffer = QPixmap(event->size());
+  Q_UNUSED(event);
+  // resize and repaint the buffers:
+  mPaintBuffersDirty = true;
   setViewport(rect());
   replot(rpQueued); // queued update is important here, to prevent painting issues in some contexts
 }
@@ -10882,29 +10988,14 @@ void QCustomPlot::wheelEvent(QWheelEvent *event)
 */
 void QCustomPlot::draw(QCPPainter *painter)
 {
-  // run through layout phases:
-  mPlotLayout->update(QCPLayoutElement::upPreparation);
-  mPlotLayout->update(QCPLayoutElement::upMargins);
-  mPlotLayout->update(QCPLayoutElement::upLayout);
+  updateLayout();
   
   // draw viewport background pixmap:
   drawBackground(painter);
 
   // draw all layered objects (grid, axes, plottables, items, legend,...):
   foreach (QCPLayer *layer, mLayers)
-  {
-    foreach (QCPLayerable *child, layer->children())
-    {
-      if (child->realVisibility())
-      {
-        painter->save();
-        painter->setClipRect(child->clipRect().translated(0, -1));
-        child->applyDefaultAntialiasingHint(painter);
-        child->draw(painter);
-        painter->restore();
-      }
-    }
-  }
+    layer->draw(painter);
   
   /* Debug code to draw all layout element rects
   foreach (QCPLayoutElement* el, findChildren<QCPLayoutElement*>())
@@ -10918,6 +11009,45 @@ void QCustomPlot::draw(QCPPainter *painter)
   */
 }
 
+/*! \internal
+  
+  Runs through the layout phases of the plot layout, so all layout elements have their final rects
+  before anything is drawn.
+*/
+void QCustomPlot::updateLayout()
+{
+  mPlotLayout->update(QCPLayoutElement::upPreparation);
+  mPlotLayout->update(QCPLayoutElement::upMargins);
+  mPlotLayout->update(QCPLayoutElement::upLayout);
+}
+
+/*! \internal
+  
+  Assigns every layer to a paint buffer and (re)allocates the buffers in the current widget size.
+  
+  The first buffer always holds the background. Consecutive logical layers share a buffer, while
+  each layer in \ref QCPLayer::lmBuffered mode gets a buffer of its own, so it can be redrawn
+  individually by \ref QCPLayer::replot. The buffers are composited bottom to top in \ref
+  paintEvent.
+*/
+void QCustomPlot::setupPaintBuffers()
+{
+  int bufferIndex = 0;
+  bool shareable = true;
+  foreach (QCPLayer *layer, mLayers)
+  {
+    if (layer->mode() == QCPLayer::lmBuffered || !shareable)
+      ++bufferIndex;
+    layer->mPaintBufferIndex = bufferIndex;
+    shareable = layer->mode() == QCPLayer::lmLogical;
+  }
+  
+  mPaintBuffers.clear();
+  for (int i=0; i<=bufferIndex; ++i)
+    mPaintBuffers.append(QPixmap(size()));
+  mPaintBuffersDirty = false;
+}
+
 /*! \internal
   
   Draws the viewport background pixmap of the plot.
@@ -14438,6 +14568,420 @@ QCPData::QCPData(double key, double value) :
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////// QCPDataMap
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*! \class QCPDataMap
+  \brief Container for storing \ref QCPData items of a QCPGraph sorted by key.
+  
+  The data is held in contiguous arrays (one for the keys, one for the values and, only if any data
+  point carries errors, one per error component) instead of a node based map. This keeps large
+  datasets compact and allows range lookups by binary search.
+  
+  The interface mirrors the parts of QMap that QCPGraph needs, iterators provide \a key() and \a
+  value() and support random access arithmetic. Note that \a value() returns the \ref QCPData by
+  value, data points can't be modified in place through an iterator.
+  
+  \see QCPData, QCPGraph::setData
+*/
+
+/*!
+  Constructs an empty data container.
+*/
+QCPDataMap::QCPDataMap() :
+  mHasErrors(false)
+{
+}
+
+/*!
+  Returns the data point at \a index, including its errors.
+*/
+QCPData QCPDataMap::at(int index) const
+{
+  QCPData result(mKeys.at(index), mValues.at(index));
+  if (hasErrors())
+  {
+    result.keyErrorPlus = mKeyErrorPlus.at(index);
+    result.keyErrorMinus = mKeyErrorMinus.at(index);
+    result.valueErrorPlus = mValueErrorPlus.at(index);
+    result.valueErrorMinus = mValueErrorMinus.at(index);
+  }
+  return result;
+}
+
+/*!
+  Returns an iterator to the first data point with a key not smaller than \a key, or \ref constEnd
+  if there is none. Uses binary search.
+*/
+QCPDataMap::const_iterator QCPDataMap::lowerBound(double key) const
+{
+  return const_iterator(this, std::lower_bound(mKeys.constBegin(), mKeys.constEnd(), key)-mKeys.constBegin());
+}
+
+/*!
+  Returns an iterator to the first data point with a key greater than \a key, or \ref constEnd if
+  there is none. Uses binary search.
+*/
+QCPDataMap::const_iterator QCPDataMap::upperBound(double key) const
+{
+  return const_iterator(this, std::upper_bound(mKeys.constBegin(), mKeys.constEnd(), key)-mKeys.constBegin());
+}
+
+/*!
+  Replaces the data with the points in \a keys and \a values. If \a keys is already sorted (which is
+  the common case for time series), both vectors are adopted without copying thanks to Qt's
+  implicit sharing. Otherwise the points are sorted by key, keeping the order of equal keys.
+  
+  The vectors should have equal length. Else, the number of points will be the size of the smallest
+  vector.
+*/
+void QCPDataMap::setData(const QVector<double> &keys, const QVector<double> &values)
+{
+  clear();
+  int n = qMin(keys.size(), values.size());
+  if (isSorted(keys, n))
+  {
+    mKeys = keys.size() == n ? keys : keys.mid(0, n);
+    mValues = values.size() == n ? values : values.mid(0, n);
+    return;
+  }
+  
+  QVector<int> order(n);
+  for (int i=0; i<n; ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&keys](int a, int b) { return keys.at(a) < keys.at(b); });
+  mKeys.resize(n);
+  mValues.resize(n);
+  for (int i=0; i<n; ++i)
+  {
+    mKeys[i] = keys.at(order.at(i));
+    mValues[i] = values.at(order.at(i));
+  }
+}
+
+/*! \overload
+  
+  Replaces the data with the points in \a data, including their errors. The points are sorted by
+  key if necessary.
+*/
+void QCPDataMap::setData(const QVector<QCPData> &data)
+{
+  clear();
+  QVector<QCPData> sorted = data;
+  std::stable_sort(sorted.begin(), sorted.end(), [](const QCPData &a, const QCPData &b) { return a.key < b.key; });
+  
+  int n = sorted.size();
+  mKeys.resize(n);
+  mValues.resize(n);
+  bool errors = false;
+  for (int i=0; i<n; ++i)
+  {
+    const QCPData &d = sorted.at(i);
+    mKeys[i] = d.key;
+    mValues[i] = d.value;
+    errors |= d.keyErrorPlus != 0 || d.keyErrorMinus != 0 || d.valueErrorPlus != 0 || d.valueErrorMinus != 0;
+  }
+  if (!errors)
+    return;
+  
+  ensureErrors();
+  for (int i=0; i<n; ++i)
+  {
+    const QCPData &d = sorted.at(i);
+    mKeyErrorPlus[i] = d.keyErrorPlus;
+    mKeyErrorMinus[i] = d.keyErrorMinus;
+    mValueErrorPlus[i] = d.valueErrorPlus;
+    mValueErrorMinus[i] = d.valueErrorMinus;
+  }
+}
+
+/*!
+  Returns the decimation level to use when \a count consecutive data points are drawn across \a
+  pixelSpan pixels. This is the coarsest level that still has at least two blocks per pixel, so
+  the per pixel minimum and maximum are retained. Returns 0 if no decimation is needed.
+  
+  \see decimate
+*/
+int QCPDataMap::decimationLevel(int count, int pixelSpan) const
+{
+  pixelSpan = qMax(1, pixelSpan);
+  int level = 0;
+  while ((count >> (level+1)) >= 2*pixelSpan)
+    ++level;
+  return level;
+}
+
+/*!
+  Fills \a result with a reduced version of the data points from \a lower to \a upper (both
+  included). For every complete block of 2^\a level points only its smallest and largest value are
+  kept, in their original order and at their original keys. The points at \a lower and \a upper
+  and the points in partial blocks at both ends are always kept. Errors are not transferred.
+  
+  The block extrema come from a min/max pyramid that is built once (in linear time) on first use
+  and kept until the data is modified, so the cost of this function only depends on the number of
+  blocks, not on the number of data points in the range.
+  
+  \see decimationLevel
+*/
+void QCPDataMap::decimate(const_iterator lower, const_iterator upper, int level, QCPDataMap &result) const
+{
+  result.clear();
+  int first = lower.index();
+  int last = upper.index();
+  if (first > last || first < 0 || last >= size())
+    return;
+  
+  if (level > 0 && mLevels.isEmpty())
+    buildLevels();
+  level = qBound(0, level, mLevels.size());
+  
+  int blockSize = 1 << level;
+  int firstBlock = (first+blockSize-1)/blockSize; // first complete block
+  int endBlock = (last+1)/blockSize; // one past the last complete block
+  if (level == 0 || firstBlock >= endBlock)
+  {
+    result.mKeys = mKeys.mid(first, last-first+1);
+    result.mValues = mValues.mid(first, last-first+1);
+    return;
+  }
+  
+  const Level &blocks = mLevels.at(level-1);
+  result.mKeys.reserve(2*(endBlock-firstBlock)+2*blockSize);
+  result.mValues.reserve(2*(endBlock-firstBlock)+2*blockSize);
+  
+  // raw points before the first complete block, at least the one at lower:
+  int lastAppended = -1;
+  for (int i=first; i<qMax(first+1, firstBlock*blockSize); ++i)
+  {
+    result.appendPoint(*this, i);
+    lastAppended = i;
+  }
+  
+  for (int b=firstBlock; b<endBlock; ++b)
+  {
+    int a = blocks.minIndex.at(b);
+    int c = blocks.maxIndex.at(b);
+    if (a > c)
+      qSwap(a, c);
+    if (a > lastAppended)
+      result.appendPoint(*this, a);
+    if (c > a && c > lastAppended)
+      result.appendPoint(*this, c);
+    lastAppended = qMax(lastAppended, c);
+  }
+  
+  // raw points after the last complete block, at least the one at upper:
+  for (int i=qMax(endBlock*blockSize, lastAppended+1); i<=last; ++i)
+    result.appendPoint(*this, i);
+  if (lastAppended < last && endBlock*blockSize > last)
+    result.appendPoint(*this, last);
+}
+
+/*!
+  Inserts \a data at \a key, after any existing data points with the same key. Appending in key
+  order is amortized constant time.
+*/
+QCPDataMap::iterator QCPDataMap::insertMulti(double key, const QCPData &data)
+{
+  int index = mKeys.isEmpty() || key >= mKeys.last() ? mKeys.size() : upperBound(key).index();
+  if (data.keyErrorPlus != 0 || data.keyErrorMinus != 0 || data.valueErrorPlus != 0 || data.valueErrorMinus != 0)
+    ensureErrors();
+  
+  mLevels.clear();
+  mKeys.insert(index, key);
+  mValues.insert(index, data.value);
+  if (hasErrors())
+  {
+    mKeyErrorPlus.insert(index, data.keyErrorPlus);
+    mKeyErrorMinus.insert(index, data.keyErrorMinus);
+    mValueErrorPlus.insert(index, data.valueErrorPlus);
+    mValueErrorMinus.insert(index, data.valueErrorMinus);
+  }
+  return iterator(this, index);
+}
+
+/*!
+  Adds all data points of \a other, merging them into the sorted order.
+*/
+void QCPDataMap::unite(const QCPDataMap &other)
+{
+  if (other.isEmpty())
+    return;
+  if (isEmpty())
+  {
+    *this = other;
+    return;
+  }
+  if (other.hasErrors())
+    ensureErrors();
+  
+  QCPDataMap merged;
+  int n = size()+other.size();
+  merged.mKeys.reserve(n);
+  merged.mValues.reserve(n);
+  if (hasErrors())
+    merged.ensureErrors();
+  
+  int i = 0, j = 0;
+  while (i < size() || j < other.size())
+  {
+    // on equal keys our own points go first, like inserting other after them would:
+    bool takeOther = i >= size() || (j < other.size() && other.mKeys.at(j) < mKeys.at(i));
+    const QCPDataMap &source = takeOther ? other : *this;
+    int index = takeOther ? j++ : i++;
+    merged.mKeys.append(source.mKeys.at(index));
+    merged.mValues.append(source.mValues.at(index));
+    if (merged.hasErrors())
+    {
+      QCPData d = source.at(index);
+      merged.mKeyErrorPlus.append(d.keyErrorPlus);
+      merged.mKeyErrorMinus.append(d.keyErrorMinus);
+      merged.mValueErrorPlus.append(d.valueErrorPlus);
+      merged.mValueErrorMinus.append(d.valueErrorMinus);
+    }
+  }
+  *this = merged;
+}
+
+/*!
+  Removes the data point at \a it and returns an iterator to the following one.
+*/
+QCPDataMap::iterator QCPDataMap::erase(iterator it)
+{
+  return erase(it, it+1);
+}
+
+/*! \overload
+  
+  Removes the data points in the range [\a first, \a last) and returns an iterator to the data
+  point that followed them.
+*/
+QCPDataMap::iterator QCPDataMap::erase(iterator first, iterator last)
+{
+  int index = first.index();
+  int count = last-first;
+  if (count > 0)
+  {
+    mLevels.clear();
+    mKeys.remove(index, count);
+    mValues.remove(index, count);
+    if (hasErrors())
+    {
+      mKeyErrorPlus.remove(index, count);
+      mKeyErrorMinus.remove(index, count);
+      mValueErrorPlus.remove(index, count);
+      mValueErrorMinus.remove(index, count);
+    }
+  }
+  return iterator(this, index);
+}
+
+/*!
+  Removes all data points with exactly \a key and returns how many were removed.
+*/
+int QCPDataMap::remove(double key)
+{
+  iterator first = lowerBound(key);
+  iterator last = upperBound(key);
+  int count = last-first;
+  erase(first, last);
+  return count;
+}
+
+/*!
+  Removes all data points.
+*/
+void QCPDataMap::clear()
+{
+  mKeys.clear();
+  mValues.clear();
+  mKeyErrorPlus.clear();
+  mKeyErrorMinus.clear();
+  mValueErrorPlus.clear();
+  mValueErrorMinus.clear();
+  mHasErrors = false;
+  mLevels.clear();
+}
+
+/*! \internal
+  
+  Allocates the error arrays (zero filled) if they don't exist yet.
+*/
+void QCPDataMap::ensureErrors()
+{
+  if (mHasErrors)
+    return;
+  mHasErrors = true;
+  mKeyErrorPlus.fill(0, mKeys.size());
+  mKeyErrorMinus.fill(0, mKeys.size());
+  mValueErrorPlus.fill(0, mKeys.size());
+  mValueErrorMinus.fill(0, mKeys.size());
+}
+
+/*! \internal
+  
+  Builds the min/max pyramid used by \ref decimate. Each level halves the previous one, so the
+  whole pyramid takes linear time and about two indices per data point.
+*/
+void QCPDataMap::buildLevels() const
+{
+  mLevels.clear();
+  int count = mKeys.size()/2;
+  while (count > 0)
+  {
+    Level level;
+    level.minIndex.resize(count);
+    level.maxIndex.resize(count);
+    for (int b=0; b<count; ++b)
+    {
+      int minA, minB, maxA, maxB;
+      if (mLevels.isEmpty())
+      {
+        minA = maxA = 2*b;
+        minB = maxB = 2*b+1;
+      } else
+      {
+        const Level &previous = mLevels.last();
+        minA = previous.minIndex.at(2*b);
+        minB = previous.minIndex.at(2*b+1);
+        maxA = previous.maxIndex.at(2*b);
+        maxB = previous.maxIndex.at(2*b+1);
+      }
+      // NaN values mark gaps, prefer real values so a gap doesn't hide the extrema:
+      level.minIndex[b] = qIsNaN(mValues.at(minA)) || mValues.at(minB) < mValues.at(minA) ? minB : minA;
+      level.maxIndex[b] = qIsNaN(mValues.at(maxA)) || mValues.at(maxB) > mValues.at(maxA) ? maxB : maxA;
+    }
+    mLevels.append(level);
+    count /= 2;
+  }
+}
+
+/*! \internal
+  
+  Appends the key and value of the data point at \a index in \a source.
+*/
+void QCPDataMap::appendPoint(const QCPDataMap &source, int index)
+{
+  mKeys.append(source.mKeys.at(index));
+  mValues.append(source.mValues.at(index));
+}
+
+/*! \internal
+  
+  Returns whether the first \a n entries of \a keys are in ascending order.
+*/
+bool QCPDataMap::isSorted(const QVector<double> &keys, int n)
+{
+  for (int i=1; i<n; ++i)
+  {
+    if (keys.at(i) < keys.at(i-1))
+      return false;
+  }
+  return true;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////// QCPGraph
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -14554,19 +15098,13 @@ void QCPGraph::setData(QCPDataMap *data, bool copy)
   Replaces the current data with the provided points in \a key and \a value pairs. The provided
   vectors should have equal length. Else, the number of added points will be the size of the
   smallest vector.
+  
+  If \a key is sorted in ascending order, the vectors are shared with the graph instead of copied,
+  so several graphs plotted over the same keys also share the same key array.
 */
 void QCPGraph::setData(const QVector<double> &key, const QVector<double> &value)
 {
-  mData->clear();
-  int n = key.size();
-  n = qMin(n, value.size());
-  QCPData newData;
-  for (int i=0; i<n; ++i)
-  {
-    newData.key = key[i];
-    newData.value = value[i];
-    mData->insertMulti(newData.key, newData);
-  }
+  mData->setData(key, value);
 }
 
 /*!
@@ -14580,10 +15118,11 @@ void QCPGraph::setData(const QVector<double> &key, const QVector<double> &value)
 */
 void QCPGraph::setDataValueError(const QVector<double> &key, const QVector<double> &value, const QVector<double> &valueError)
 {
-  mData->clear();
+  QVector<QCPData> data;
   int n = key.size();
   n = qMin(n, value.size());
   n = qMin(n, valueError.size());
+  data.reserve(n);
   QCPData newData;
   for (int i=0; i<n; ++i)
   {
@@ -14591,8 +15130,9 @@ void QCPGraph::setDataValueError(const QVector<double> &key, const QVector<doubl
     newData.value = value[i];
     newData.valueErrorMinus = valueError[i];
     newData.valueErrorPlus = valueError[i];
-    mData->insertMulti(key[i], newData);
+    data.append(newData);
   }
+  mData->setData(data);
 }
 
 /*!
@@ -14606,11 +15146,12 @@ void QCPGraph::setDataValueError(const QVector<double> &key, const QVector<doubl
 */
 void QCPGraph::setDataValueError(const QVector<double> &key, const QVector<double> &value, const QVector<double> &valueErrorMinus, const QVector<double> &valueErrorPlus)
 {
-  mData->clear();
+  QVector<QCPData> data;
   int n = key.size();
   n = qMin(n, value.size());
   n = qMin(n, valueErrorMinus.size());
   n = qMin(n, valueErrorPlus.size());
+  data.reserve(n);
   QCPData newData;
   for (int i=0; i<n; ++i)
   {
@@ -14618,8 +15159,9 @@ void QCPGraph::setDataValueError(const QVector<double> &key, const QVector<doubl
     newData.value = value[i];
     newData.valueErrorMinus = valueErrorMinus[i];
     newData.valueErrorPlus = valueErrorPlus[i];
-    mData->insertMulti(key[i], newData);
+    data.append(newData);
   }
+  mData->setData(data);
 }
 
 /*!
@@ -14633,10 +15175,11 @@ void QCPGraph::setDataValueError(const QVector<double> &key, const QVector<doubl
 */
 void QCPGraph::setDataKeyError(const QVector<double> &key, const QVector<double> &value, const QVector<double> &keyError)
 {
-  mData->clear();
+  QVector<QCPData> data;
   int n = key.size();
   n = qMin(n, value.size());
   n = qMin(n, keyError.size());
+  data.reserve(n);
   QCPData newData;
   for (int i=0; i<n; ++i)
   {
@@ -14644,8 +15187,9 @@ void QCPGraph::setDataKeyError(const QVector<double> &key, const QVector<double>
     newData.value = value[i];
     newData.keyErrorMinus = keyError[i];
     newData.keyErrorPlus = keyError[i];
-    mData->insertMulti(key[i], newData);
+    data.append(newData);
   }
+  mData->setData(data);
 }
 
 /*!
@@ -14659,11 +15203,12 @@ void QCPGraph::setDataKeyError(const QVector<double> &key, const QVector<double>
 */
 void QCPGraph::setDataKeyError(const QVector<double> &key, const QVector<double> &value, const QVector<double> &keyErrorMinus, const QVector<double> &keyErrorPlus)
 {
-  mData->clear();
+  QVector<QCPData> data;
   int n = key.size();
   n = qMin(n, value.size());
   n = qMin(n, keyErrorMinus.size());
   n = qMin(n, keyErrorPlus.size());
+  data.reserve(n);
   QCPData newData;
   for (int i=0; i<n; ++i)
   {
@@ -14671,8 +15216,9 @@ void QCPGraph::setDataKeyError(const QVector<double> &key, const QVector<double>
     newData.value = value[i];
     newData.keyErrorMinus = keyErrorMinus[i];
     newData.keyErrorPlus = keyErrorPlus[i];
-    mData->insertMulti(key[i], newData);
+    data.append(newData);
   }
+  mData->setData(data);
 }
 
 /*!
@@ -14686,11 +15232,12 @@ void QCPGraph::setDataKeyError(const QVector<double> &key, const QVector<double>
 */
 void QCPGraph::setDataBothError(const QVector<double> &key, const QVector<double> &value, const QVector<double> &keyError, const QVector<double> &valueError)
 {
-  mData->clear();
+  QVector<QCPData> data;
   int n = key.size();
   n = qMin(n, value.size());
   n = qMin(n, valueError.size());
   n = qMin(n, keyError.size());
+  data.reserve(n);
   QCPData newData;
   for (int i=0; i<n; ++i)
   {
@@ -14700,8 +15247,9 @@ void QCPGraph::setDataBothError(const QVector<double> &key, const QVector<double
     newData.keyErrorPlus = keyError[i];
     newData.valueErrorMinus = valueError[i];
     newData.valueErrorPlus = valueError[i];
-    mData->insertMulti(key[i], newData);
+    data.append(newData);
   }
+  mData->setData(data);
 }
 
 /*!
@@ -14715,13 +15263,14 @@ void QCPGraph::setDataBothError(const QVector<double> &key, const QVector<double
 */
 void QCPGraph::setDataBothError(const QVector<double> &key, const QVector<double> &value, const QVector<double> &keyErrorMinus, const QVector<double> &keyErrorPlus, const QVector<double> &valueErrorMinus, const QVector<double> &valueErrorPlus)
 {
-  mData->clear();
+  QVector<QCPData> data;
   int n = key.size();
   n = qMin(n, value.size());
   n = qMin(n, valueErrorMinus.size());
   n = qMin(n, valueErrorPlus.size());
   n = qMin(n, keyErrorMinus.size());
   n = qMin(n, keyErrorPlus.size());
+  data.reserve(n);
   QCPData newData;
   for (int i=0; i<n; ++i)
   {
@@ -14731,8 +15280,9 @@ void QCPGraph::setDataBothError(const QVector<double> &key, const QVector<double
     newData.keyErrorPlus = keyErrorPlus[i];
     newData.valueErrorMinus = valueErrorMinus[i];
     newData.valueErrorPlus = valueErrorPlus[i];
-    mData->insertMulti(key[i], newData);
+    data.append(newData);
   }
+  mData->setData(data);
 }
 
 
@@ -14921,14 +15471,9 @@ void QCPGraph::addData(double key, double value)
 */
 void QCPGraph::addData(const QVector<double> &keys, const QVector<double> &values)
 {
-  int n = qMin(keys.size(), values.size());
-  QCPData newData;
-  for (int i=0; i<n; ++i)
-  {
-    newData.key = keys[i];
-    newData.value = values[i];
-    mData->insertMulti(newData.key, newData);
-  }
+  QCPDataMap newData;
+  newData.setData(keys, values);
+  mData->unite(newData);
 }
 
 /*!
@@ -14937,9 +15482,7 @@ void QCPGraph::addData(const QVector<double> &keys, const QVector<double> &value
 */
 void QCPGraph::removeDataBefore(double key)
 {
-  QCPDataMap::iterator it = mData->begin();
-  while (it != mData->end() && it.key() < key)
-    it = mData->erase(it);
+  mData->erase(mData->begin(), mData->lowerBound(key));
 }
 
 /*!
@@ -14949,9 +15492,7 @@ void QCPGraph::removeDataBefore(double key)
 void QCPGraph::removeDataAfter(double key)
 {
   if (mData->isEmpty()) return;
-  QCPDataMap::iterator it = mData->upperBound(key);
-  while (it != mData->end())
-    it = mData->erase(it);
+  mData->erase(mData->upperBound(key), mData->end());
 }
 
 /*!
@@ -14964,10 +15505,7 @@ void QCPGraph::removeDataAfter(double key)
 void QCPGraph::removeData(double fromKey, double toKey)
 {
   if (fromKey >= toKey || mData->isEmpty()) return;
-  QCPDataMap::iterator it = mData->upperBound(fromKey);
-  QCPDataMap::iterator itEnd = mData->upperBound(toKey);
-  while (it != itEnd)
-    it = mData->erase(it);
+  mData->erase(mData->upperBound(fromKey), mData->upperBound(toKey));
 }
 
 /*! \overload
@@ -15678,6 +16216,22 @@ void QCPGraph::getPreparedData(QVector<QCPData> *lineData, QVector<QCPData> *sca
   if (lower == mData->constEnd() || upper == mData->constEnd())
     return;
   
+  // on large datasets, let adaptive sampling work on the precomputed min/max blocks instead of all
+  // points. The level keeps at least two blocks per pixel, so the result looks the same while the
+  // cost per replot only depends on the pixel span:
+  QCPDataMap decimatedData;
+  if (mAdaptiveSampling && !mData->hasErrors())
+  {
+    int keyPixelSpan = qAbs(keyAxis->coordToPixel(lower.key())-keyAxis->coordToPixel(upper.key()));
+    int level = mData->decimationLevel(upper-lower+1, keyPixelSpan);
+    if (level > 0)
+    {
+      mData->decimate(lower, upper, level, decimatedData);
+      lower = decimatedData.constBegin();
+      upper = decimatedData.constEnd()-1;
+    }
+  }
+  
   // count points in visible range, taking into account that we only need to count to the limit maxCount if using adaptive sampling:
   int maxCount = std::numeric_limits<int>::max();
   if (mAdaptiveSampling)
@@ -15976,7 +16530,7 @@ void QCPGraph::getVisibleDataBounds(QCPDataMap::const_iterator &lower, QCPDataMa
     return;
   }
   
-  // get visible data range as QMap iterators
+  // get visible data range by binary search on the keys
   QCPDataMap::const_iterator lbound = mData->lowerBound(mKeyAxis.data()->range().lower);
   QCPDataMap::const_iterator ubound = mData->upperBound(mKeyAxis.data()->range().upper);
   bool lowoutlier = lbound != mData->constBegin(); // indicates whether there exist points below axis range
@@ -16000,14 +16554,7 @@ int QCPGraph::countDataInBounds(const QCPDataMap::const_iterator &lower, const Q
 {
   if (upper == mData->constEnd() && lower == mData->constEnd())
     return 0;
-  QCPDataMap::const_iterator it = lower;
-  int count = 1;
-  while (it != upper && count < maxCount)
-  {
-    ++it;
-    ++count;
-  }
-  return count;
+  return qMin(upper-lower+1, maxCount);
 }
 
 /*! \internal
@@ -371,8 +371,19 @@ class QCP_LIB_DECL QCPLayer : public QObject
   Q_PROPERTY(int index READ index)
   Q_PROPERTY(QList<QCPLayerable*> children READ children)
   Q_PROPERTY(bool visible READ visible WRITE setVisible)
+  Q_PROPERTY(LayerMode mode READ mode WRITE setMode)
   /// \endcond
 public:
+  /*!
+    Defines how the layer is rendered into the paint buffers of the parent plot.
+    
+    \see setMode
+  */
+  enum LayerMode { lmLogical   ///< Layer is drawn into the paint buffer it shares with the neighbouring logical layers
+                   ,lmBuffered ///< Layer has its own paint buffer and may be replotted individually with \ref replot
+                 };
+  Q_ENUMS(LayerMode)
+  
   QCPLayer(QCustomPlot* parentPlot, const QString &layerName);
   ~QCPLayer();
   
@@ -382,9 +393,14 @@ public:
   int index() const { return mIndex; }
   QList<QCPLayerable*> children() const { return mChildren; }
   bool visible() const { return mVisible; }
+  LayerMode mode() const { return mMode; }
   
   // setters:
   void setVisible(bool visible);
+  void setMode(LayerMode mode);
+  
+  // non-property methods:
+  void replot();
   
 protected:
   // property members:
@@ -393,10 +409,15 @@ protected:
   int mIndex;
   QList<QCPLayerable*> mChildren;
   bool mVisible;
+  LayerMode mMode;
+  
+  // non-property members:
+  int mPaintBufferIndex;
   
   // non-virtual methods:
   void addChild(QCPLayerable *layerable, bool prepend);
   void removeChild(QCPLayerable *layerable);
+  void draw(QCPPainter *painter);
   
 private:
   Q_DISABLE_COPY(QCPLayer)
@@ -469,6 +490,7 @@ private:
   Q_DISABLE_COPY(QCPLayerable)
   
   friend class QCustomPlot;
+  friend class QCPLayer;
   friend class QCPAxisRect;
 };
 
@@ -1864,7 +1886,8 @@ protected:
   Qt::KeyboardModifier mMultiSelectModifier;
   
   // non-property members:
-  QPixmap mPaintBuffer;
+  QList<QPixmap> mPaintBuffers;
+  bool mPaintBuffersDirty;
   QPoint mMousePressPos;
   QPointer<QCPLayoutElement> mMouseEventElement;
   bool mReplotting;
@@ -1889,6 +1912,8 @@ protected:
   void updateLayerIndices() const;
   QCPLayerable *layerableAt(const QPointF &pos, bool onlySelectable, QVariant *selectionDetails=0) const;
   void drawBackground(QCPPainter *painter);
+  void updateLayout();
+  void setupPaintBuffers();
   
   friend class QCPLegend;
   friend class QCPAxis;
@@ -2475,16 +2500,90 @@ public:
 };
 Q_DECLARE_TYPEINFO(QCPData, Q_MOVABLE_TYPE);
 
-/*! \typedef QCPDataMap
-  Container for storing \ref QCPData items in a sorted fashion. The key of the map
-  is the key member of the QCPData instance.
+class QCP_LIB_DECL QCPDataMap
+{
+public:
+  class const_iterator
+  {
+  public:
+    const_iterator() : mMap(0), mIndex(0) {}
+    const_iterator(const QCPDataMap *map, int index) : mMap(map), mIndex(index) {}
+    
+    double key() const { return mMap->mKeys.at(mIndex); }
+    QCPData value() const { return mMap->at(mIndex); }
+    QCPData operator*() const { return value(); }
+    int index() const { return mIndex; }
+    
+    const_iterator &operator++() { ++mIndex; return *this; }
+    const_iterator operator++(int) { const_iterator result = *this; ++mIndex; return result; }
+    const_iterator &operator--() { --mIndex; return *this; }
+    const_iterator operator--(int) { const_iterator result = *this; --mIndex; return result; }
+    const_iterator &operator+=(int j) { mIndex += j; return *this; }
+    const_iterator &operator-=(int j) { mIndex -= j; return *this; }
+    const_iterator operator+(int j) const { return const_iterator(mMap, mIndex+j); }
+    const_iterator operator-(int j) const { return const_iterator(mMap, mIndex-j); }
+    int operator-(const const_iterator &other) const { return mIndex-other.mIndex; }
+    bool operator==(const const_iterator &other) const { return mMap == other.mMap && mIndex == other.mIndex; }
+    bool operator!=(const const_iterator &other) const { return !(*this == other); }
+    
+  private:
+    const QCPDataMap *mMap;
+    int mIndex;
+  };
+  typedef const_iterator iterator;
   
-  This is the container in which QCPGraph holds its data.
-  \see QCPData, QCPGraph::setData
-*/
-typedef QMap<double, QCPData> QCPDataMap;
-typedef QMapIterator<double, QCPData> QCPDataMapIterator;
-typedef QMutableMapIterator<double, QCPData> QCPDataMutableMapIterator;
+  QCPDataMap();
+  
+  // getters:
+  int size() const { return mKeys.size(); }
+  int count() const { return mKeys.size(); }
+  bool isEmpty() const { return mKeys.isEmpty(); }
+  bool hasErrors() const { return mHasErrors; }
+  const QVector<double> &keys() const { return mKeys; }
+  const QVector<double> &values() const { return mValues; }
+  QCPData at(int index) const;
+  
+  // iterators:
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, mKeys.size()); }
+  const_iterator constBegin() const { return begin(); }
+  const_iterator constEnd() const { return end(); }
+  const_iterator lowerBound(double key) const;
+  const_iterator upperBound(double key) const;
+  
+  // setters:
+  void setData(const QVector<double> &keys, const QVector<double> &values);
+  void setData(const QVector<QCPData> &data);
+  
+  // non-property methods:
+  int decimationLevel(int count, int pixelSpan) const;
+  void decimate(const_iterator lower, const_iterator upper, int level, QCPDataMap &result) const;
+  iterator insertMulti(double key, const QCPData &data);
+  void unite(const QCPDataMap &other);
+  iterator erase(iterator it);
+  iterator erase(iterator first, iterator last);
+  int remove(double key);
+  void clear();
+  
+private:
+  // keys and values are kept in separate sorted arrays, the error arrays are only
+  // allocated once a data point with errors is added:
+  QVector<double> mKeys, mValues;
+  QVector<double> mKeyErrorPlus, mKeyErrorMinus, mValueErrorPlus, mValueErrorMinus;
+  bool mHasErrors;
+  
+  // min/max pyramid used for decimation, level k (stored at k-1) holds the indices of the smallest
+  // and largest value in each block of 2^k points. Built on first use, dropped on modification:
+  struct Level { QVector<int> minIndex, maxIndex; };
+  mutable QVector<Level> mLevels;
+  
+  void ensureErrors();
+  void buildLevels() const;
+  void appendPoint(const QCPDataMap &source, int index);
+  static bool isSorted(const QVector<double> &keys, int n);
+  
+  friend class const_iterator;
+};
 
 
 class QCP_LIB_DECL QCPGraph : public QCPAbstractPlottable
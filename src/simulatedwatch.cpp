@@ -0,0 +1,250 @@
+#include "simulatedwatch.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <QDebug>
+#include <string.h>
+
+#include "ttwatch.h"
+
+static quint32 readId( const quint8 * data )
+{
+    return ( data[0] << 24 ) | ( data[1] << 16 ) | ( data[2] << 8 ) | data[3];
+}
+
+static void writeId( QByteArray & dest, int pos, quint32 id )
+{
+    dest[pos + 0] = (char)( ( id >> 24 ) & 0xff );
+    dest[pos + 1] = (char)( ( id >> 16 ) & 0xff );
+    dest[pos + 2] = (char)( ( id >> 8 ) & 0xff );
+    dest[pos + 3] = (char)( id & 0xff );
+}
+
+SimulatedWatchTransport::SimulatedWatchTransport() :
+    m_Open(false),
+    m_LatencyUs(0),
+    m_FailureRate(0),
+    m_BatteryLevel(100),
+    m_ListPos(0),
+    m_ReadFile(0),
+    m_ReadPos(0)
+{
+    m_Clock.start();
+}
+
+bool SimulatedWatchTransport::loadDirectory(const QString &path)
+{
+    QDir dir(path);
+    if ( !dir.exists() )
+    {
+        qWarning() << "SimulatedWatchTransport::loadDirectory / no such directory " << path;
+        return false;
+    }
+
+    quint32 workout = 0;
+    foreach ( const QFileInfo & fi, dir.entryInfoList(QDir::Files, QDir::Name) )
+    {
+        QFile f(fi.filePath());
+        if ( !f.open(QIODevice::ReadOnly) )
+        {
+            continue;
+        }
+
+        bool isId = false;
+        quint32 id = fi.baseName().toUInt(&isId, 16);
+        if ( isId && fi.baseName().length() == 8 )
+        {
+            setFile(id, f.readAll());
+        }
+        else if ( fi.suffix().compare("ttbin", Qt::CaseInsensitive) == 0 )
+        {
+            setFile(FILE_TTBIN_DATA | workout++, f.readAll());
+        }
+        else if ( fi.fileName().compare("preferences.xml", Qt::CaseInsensitive) == 0 )
+        {
+            setFile(FILE_PREFERENCES_XML, f.readAll());
+        }
+    }
+    return true;
+}
+
+void SimulatedWatchTransport::setFile(quint32 id, const QByteArray &data)
+{
+    m_Files.insert(id, data);
+}
+
+QByteArray SimulatedWatchTransport::file(quint32 id) const
+{
+    return m_Files.value(id);
+}
+
+bool SimulatedWatchTransport::hasFile(quint32 id) const
+{
+    return m_Files.contains(id);
+}
+
+void SimulatedWatchTransport::setLatency(int usecs)
+{
+    m_LatencyUs = usecs;
+}
+
+void SimulatedWatchTransport::setFailureRate(double rate)
+{
+    m_FailureRate = rate;
+}
+
+void SimulatedWatchTransport::setBatteryLevel(int level)
+{
+    m_BatteryLevel = level;
+}
+
+bool SimulatedWatchTransport::open()
+{
+    m_Open = true;
+    m_Responses.clear();
+    return true;
+}
+
+void SimulatedWatchTransport::close()
+{
+    m_Open = false;
+    m_Responses.clear();
+}
+
+bool SimulatedWatchTransport::isOpen() const
+{
+    return m_Open;
+}
+
+QByteArray SimulatedWatchTransport::fileStatus(quint8 command, quint32 id, quint32 length, quint8 status)
+{
+    // the layout TTWatch expects: id at 5, length at 13, status at 20.
+    QByteArray payload(22, 0);
+    payload[0] = (char)command;
+    writeId(payload, 5, id);
+    writeId(payload, 13, length);
+    payload[20] = (char)status;
+    return payload;
+}
+
+QByteArray SimulatedWatchTransport::handle(const quint8 *report)
+{
+    int commandLength = report[1] - 1;
+    const quint8 * command = report + 3;
+    quint32 id = commandLength >= 5 ? readId(command + 1) : 0;
+
+    switch ( command[0] )
+    {
+    case TT_READ_FIRST:
+        m_Listing = m_Files.keys();
+        m_ListPos = 0;
+        return fileStatus(command[0], 0, 0, 0);
+
+    case TT_READ_NEXT:
+        if ( m_ListPos >= m_Listing.count() )
+        {
+            return fileStatus(command[0], 0, 0, 1);
+        }
+        id = m_Listing.at(m_ListPos++);
+        return fileStatus(command[0], id, m_Files.value(id).length(), 0);
+
+    case TT_OPEN_FILE_READ:
+        m_ReadFile = id;
+        m_ReadPos = 0;
+        return fileStatus(command[0], id, 0, m_Files.contains(id) ? 0 : 1);
+
+    case TT_GET_FILE_SIZE:
+        return fileStatus(command[0], id, m_Files.value(id).length(), m_Files.contains(id) ? 0 : 1);
+
+    case TT_READ_FILE:
+    {
+        int len = commandLength >= 8 ? command[7] : 0;
+        QByteArray data = m_Files.value(m_ReadFile).mid(m_ReadPos, len);
+        m_ReadPos += data.length();
+
+        QByteArray payload(9, 0);
+        payload[0] = (char)command[0];
+        writeId(payload, 1, id);
+        payload[8] = (char)data.length();
+        return payload + data;
+    }
+
+    case TT_CREATE_FILE:
+        m_Files.insert(id, QByteArray());
+        return fileStatus(command[0], id, 0, 0);
+
+    case TT_WRITE_FILE:
+        m_Files[id].append((const char*)command + 5, commandLength - 5);
+        return fileStatus(command[0], id, m_Files.value(id).length(), 0);
+
+    case TT_DELETE_FILE:
+        return fileStatus(command[0], id, 0, m_Files.remove(id) > 0 ? 0 : 1);
+
+    case TT_GET_BATTERY_LEVEL:
+    {
+        QByteArray payload(2, 0);
+        payload[0] = (char)command[0];
+        payload[1] = (char)m_BatteryLevel;
+        return payload;
+    }
+
+    default:
+        return fileStatus(command[0], id, 0, 0);
+    }
+}
+
+int SimulatedWatchTransport::write(const quint8 *report, int length)
+{
+    if ( !m_Open || length < WATCH_REPORT_SIZE || report[1] < 1 || report[1] > WATCH_REPORT_SIZE - 3 )
+    {
+        return -1;
+    }
+
+    QByteArray payload = handle(report);
+    if ( m_FailureRate > 0 && qrand() < m_FailureRate * RAND_MAX )
+    {
+        return length; // lost on the way back.
+    }
+
+    Response r;
+    r.readyAt = m_Clock.nsecsElapsed() / 1000 + m_LatencyUs;
+    r.report = QByteArray(WATCH_REPORT_SIZE, 0);
+    r.report[0] = report[0];
+    r.report[1] = (char)payload.length();
+    r.report[2] = report[2]; // echo the sequence counter
+    memcpy(r.report.data() + 3, payload.constData(), payload.length());
+    m_Responses.enqueue(r);
+    return length;
+}
+
+int SimulatedWatchTransport::read(quint8 *report, int length, int timeoutMs)
+{
+    if ( !m_Open )
+    {
+        return -1;
+    }
+
+    if ( m_Responses.isEmpty() )
+    {
+        QThread::msleep(timeoutMs);
+        return 0;
+    }
+
+    qint64 wait = m_Responses.head().readyAt - m_Clock.nsecsElapsed() / 1000;
+    if ( wait > (qint64)timeoutMs * 1000 )
+    {
+        QThread::msleep(timeoutMs);
+        return 0;
+    }
+    if ( wait > 0 )
+    {
+        QThread::usleep(wait);
+    }
+
+    Response r = m_Responses.dequeue();
+    int count = qMin(length, r.report.length());
+    memcpy(report, r.report.constData(), count);
+    return count;
+}
@@ -0,0 +1,64 @@
+#ifndef SIMULATEDWATCH_H
+#define SIMULATEDWATCH_H
+
+#include <QString>
+#include <QByteArray>
+#include <QMap>
+#include <QList>
+#include <QQueue>
+#include <QElapsedTimer>
+#include "iwatchtransport.h"
+
+// An in-process watch that answers the protocol from a virtual file system,
+// so downloads can be exercised and timed without a device. Responses become
+// available a fixed latency after their command was written, commands that are
+// written back to back overlap like they do on the real USB link.
+class SimulatedWatchTransport : public IWatchTransport
+{
+    struct Response
+    {
+        qint64 readyAt; // usecs on m_Clock
+        QByteArray report;
+    };
+
+    QMap<quint32, QByteArray> m_Files;
+    QQueue<Response> m_Responses;
+    QElapsedTimer m_Clock;
+    bool m_Open;
+    int m_LatencyUs;
+    double m_FailureRate;
+    int m_BatteryLevel;
+
+    QList<quint32> m_Listing;
+    int m_ListPos;
+    quint32 m_ReadFile;
+    int m_ReadPos;
+
+    QByteArray handle( const quint8 * report );
+    static QByteArray fileStatus( quint8 command, quint32 id, quint32 length, quint8 status );
+
+public:
+    SimulatedWatchTransport();
+
+    // *.ttbin files become workouts, preferences.xml the preferences and files
+    // named after a file id in hex (00850000.bin) are taken as is.
+    bool loadDirectory( const QString & path );
+    void setFile( quint32 id, const QByteArray & data );
+    QByteArray file( quint32 id ) const;
+    bool hasFile( quint32 id ) const;
+
+    void setLatency( int usecs );
+    // fraction of the commands that get no response, to exercise the error paths.
+    void setFailureRate( double rate );
+    void setBatteryLevel( int level );
+
+    bool open();
+    void close();
+    bool isOpen() const;
+    bool isDevice() const { return false; }
+
+    int write( const quint8 * report, int length );
+    int read( quint8 * report, int length, int timeoutMs );
+};
+
+#endif // SIMULATEDWATCH_H
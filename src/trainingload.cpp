@@ -0,0 +1,156 @@
+#include "trainingload.h"
+
+#include <qmath.h>
+
+// heart rate reserve bounds, TRIMP is cached per workout so these are fixed.
+#define TRIMP_REST_HR 60
+#define TRIMP_MAX_HR 190
+// samples further apart are a pause and do not count towards the load.
+#define TRIMP_MAX_GAP 60
+
+#define ATL_DAYS 7
+#define CTL_DAYS 42
+
+TrainingLoad::TrainingLoad() :
+    m_ValidDays(0)
+{
+}
+
+void TrainingLoad::update(const QDate &date, double delta)
+{
+    if ( !date.isValid() || delta == 0 )
+    {
+        return;
+    }
+
+    if ( !m_Start.isValid() )
+    {
+        m_Start = date;
+    }
+    else if ( date < m_Start )
+    {
+        // everything shifts, the whole series has to be recomputed.
+        m_Days.insert(0, date.daysTo(m_Start), Day());
+        m_Start = date;
+        m_ValidDays = 0;
+    }
+
+    int day = m_Start.daysTo(date);
+    if ( day >= m_Days.count() )
+    {
+        m_Days.resize(day + 1);
+    }
+
+    m_Days[day].load += delta;
+    m_ValidDays = qMin(m_ValidDays, day);
+}
+
+void TrainingLoad::add(const QDate &date, double trimp)
+{
+    update(date, trimp);
+}
+
+void TrainingLoad::remove(const QDate &date, double trimp)
+{
+    update(date, -trimp);
+}
+
+void TrainingLoad::clear()
+{
+    m_Start = QDate();
+    m_Days.clear();
+    m_ValidDays = 0;
+}
+
+void TrainingLoad::ensure(int day) const
+{
+    if ( day >= m_Days.count() )
+    {
+        m_Days.resize(day + 1);
+    }
+    if ( day < m_ValidDays )
+    {
+        return;
+    }
+
+    const double atlK = 1.0 - qExp(-1.0 / ATL_DAYS);
+    const double ctlK = 1.0 - qExp(-1.0 / CTL_DAYS);
+
+    for ( int i = m_ValidDays; i <= day; i++ )
+    {
+        Day previous = i > 0 ? m_Days.at(i - 1) : Day();
+        Day & d = m_Days[i];
+        d.date = m_Start.addDays(i);
+        d.atl = previous.atl + ( d.load - previous.atl ) * atlK;
+        d.ctl = previous.ctl + ( d.load - previous.ctl ) * ctlK;
+        d.tsb = previous.ctl - previous.atl;
+    }
+    m_ValidDays = day + 1;
+}
+
+TrainingLoad::Day TrainingLoad::day(const QDate &date) const
+{
+    if ( !m_Start.isValid() || date < m_Start )
+    {
+        Day d;
+        d.date = date;
+        return d;
+    }
+
+    int day = m_Start.daysTo(date);
+    ensure(day);
+    return m_Days.at(day);
+}
+
+QVector<TrainingLoad::Day> TrainingLoad::series(const QDate &from, const QDate &to) const
+{
+    QVector<Day> result;
+    if ( from > to )
+    {
+        return result;
+    }
+
+    result.reserve(from.daysTo(to) + 1);
+    if ( m_Start.isValid() && to >= m_Start )
+    {
+        ensure(m_Start.daysTo(to));
+    }
+    for ( QDate date = from; date <= to; date = date.addDays(1) )
+    {
+        result.append(day(date));
+    }
+    return result;
+}
+
+double TrainingLoad::trimp(ActivityPtr activity)
+{
+    if ( activity.isNull() )
+    {
+        return 0;
+    }
+
+    double trimp = 0;
+    qint64 previous = -1;
+    foreach ( LapPtr lap, activity->laps() )
+    {
+        foreach ( TrackPointPtr tp, lap->points() )
+        {
+            if ( tp->heartRate() <= 0 )
+            {
+                continue;
+            }
+
+            qint64 time = tp->time().toMSecsSinceEpoch();
+            double seconds = previous < 0 ? 0 : ( time - previous ) / 1000.0;
+            previous = time;
+            if ( seconds <= 0 || seconds > TRIMP_MAX_GAP )
+            {
+                continue;
+            }
+
+            double hrr = qBound(0.0, double(tp->heartRate() - TRIMP_REST_HR) / ( TRIMP_MAX_HR - TRIMP_REST_HR ), 1.0);
+            trimp += seconds / 60.0 * hrr * 0.64 * qExp(1.92 * hrr);
+        }
+    }
+    return trimp;
+}
@@ -0,0 +1,46 @@
+#ifndef TRAININGLOAD_H
+#define TRAININGLOAD_H
+
+#include <QDate>
+#include <QVector>
+#include "activity.h"
+
+// Fitness (CTL), fatigue (ATL) and form (TSB) from the daily TRIMP of the
+// library. Workouts only change the load of their own day, the exponentially
+// weighted averages are recomputed lazily from the earliest changed day on.
+class TrainingLoad
+{
+public:
+    struct Day
+    {
+        QDate date;
+        double load; // TRIMP of all workouts on this day
+        double atl;
+        double ctl;
+        double tsb;  // form going into the day, ctl - atl of the day before
+
+        Day() : load(0), atl(0), ctl(0), tsb(0) {}
+    };
+
+    TrainingLoad();
+
+    void add( const QDate & date, double trimp );
+    void remove( const QDate & date, double trimp );
+    void clear();
+
+    Day day( const QDate & date ) const;
+    QVector<Day> series( const QDate & from, const QDate & to ) const;
+
+    // Banister TRIMP of one workout, taken in a single pass over its heart rate samples.
+    static double trimp( ActivityPtr activity );
+
+private:
+    QDate m_Start;              // date of m_Days[0]
+    mutable QVector<Day> m_Days;
+    mutable int m_ValidDays;    // leading days with an up to date atl/ctl/tsb
+
+    void update( const QDate & date, double delta );
+    void ensure( int day ) const;
+};
+
+#endif // TRAININGLOAD_H
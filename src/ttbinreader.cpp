@@ -9,6 +9,7 @@
 #include <QDebug>
 
 #include <QFile>
+#include <QBuffer>
 #include "order32.h"
 
 
@@ -583,134 +584,147 @@ bool TTBinReader::skipTag(QIODevice &ttbin, quint8 tag, int size, QByteArray * c
     return true;
 }
 
-TTBinReader::TTBinReader()
+TTBinReader::TTBinReader() :
+    m_UTCOffset(0),
+    m_Offset(0),
+    m_StreamForgiving(false)
 {
 }
 
 
 
-ActivityPtr TTBinReader::read(QIODevice &ttbin, bool forgiving, bool headerAndSummaryOnly)
+bool TTBinReader::readRecord(QIODevice &ttbin, ActivityPtr ap, bool forgiving, bool headerAndSummaryOnly)
 {
-    if ( !ttbin.isOpen() )
+    quint8 tag;
+
+    if ( !ttbin.getChar((char*)&tag) )
     {
-        return ActivityPtr();
+        qDebug() << "TTBinReader::read / could not read tag.";
+        return false;
     }
 
-    m_RecordLengths.clear();
-
-    ActivityPtr ap = ActivityPtr::create();
-
-    quint8 tag;
-
-    while ( !ttbin.atEnd() )
+    if ( tag != TAG_FILE_HEADER )
     {
-        if ( !ttbin.getChar((char*)&tag) )
+
+        if ( !m_RecordLengths.contains(tag) )
         {
-            qDebug() << "TTBinReader::read / could not read tag.";
-            return ActivityPtr();
+            return true; //skipping.
         }
 
-        if ( tag != TAG_FILE_HEADER )
+        if ( forgiving && m_RecordLengths.contains(tag))
         {
-
-            if ( !m_RecordLengths.contains(tag) )
+            int recordLength = m_RecordLengths[tag];
+            QByteArray data = ttbin.peek(recordLength+1);
+            if ( data.length() == recordLength + 1 )
             {
-                continue; //skipping.
-            }
-
-            if ( forgiving && m_RecordLengths.contains(tag))
-            {
-                int recordLength = m_RecordLengths[tag];
-                QByteArray data = ttbin.peek(recordLength+1);
-                if ( data.length() == recordLength + 1 )
+                quint8 nextTag = (quint8)data.at(recordLength);
+                if ( !m_RecordLengths.contains(nextTag))
                 {
-                    quint8 nextTag = (quint8)data.at(recordLength);
-                    if ( !m_RecordLengths.contains(nextTag))
-                    {
-                        // qDebug() << "This does not appear to be a valid record, skipping one.";
-                        continue;
-                    }
+                    // qDebug() << "This does not appear to be a valid record, skipping one.";
+                    return true;
                 }
             }
         }
+    }
 
-        bool result = false;
+    bool result = false;
 
 
-        quint8 switchTag = tag;
+    quint8 switchTag = tag;
 
-        if ( headerAndSummaryOnly )
+    if ( headerAndSummaryOnly )
+    {
+        if ( switchTag != TAG_FILE_HEADER && switchTag != TAG_SUMMARY )
         {
-            if ( switchTag != TAG_FILE_HEADER && switchTag != TAG_SUMMARY )
-            {
-                switchTag = TAG_UNHANDLED;
-            }
+            switchTag = TAG_UNHANDLED;
         }
+    }
 
-        switch ( switchTag )
+    switch ( switchTag )
+    {
+    case TAG_FILE_HEADER: // header;
+        if ( m_Offset + ttbin.pos() == 1 )
         {
-        case TAG_FILE_HEADER: // header;
-            if ( ttbin.pos() == 1 )
+            result = readHeader(ttbin, ap);
+        }
+        else
+        {
+            if ( forgiving )
             {
-                result = readHeader(ttbin, ap);
+                // qDebug() << "TTBinReader::read / got header not at start skipping.";
+                result = true;
             }
             else
             {
-                if ( forgiving )
-                {
-                    // qDebug() << "TTBinReader::read / got header not at start skipping.";
-                    result = true;
-                }
-                else
-                {
-                    result = false;
-                }
-
+                result = false;
             }
 
-            break;
-        case TAG_SUMMARY: // summary at end.
-            result = readSummary(ttbin, ap);
-            break;
+        }
 
-        case TAG_STATUS: // lap.
-            result = readStatus(ttbin, ap);
-            break;
-        case TAG_GPS: // GPS pos + cadence
-            result = readPosition(ttbin, ap, forgiving);
-            break;
-        case TAG_HEART_RATE: // heart rate on Cardio Models
-            result = readHeartRate(ttbin, ap);
-            break;
-        case TAG_TREADMILL:
-            result = readTreadmill(ttbin, ap);
-            break;
-        case TAG_SWIM:
-            result = readSwim(ttbin, ap);
-            break;
-        case TAG_ALTITUDE_UPDATE:
-            result = readAltitude(ttbin, ap);
-            break;
-        case TAG_HEART_RATE_RECOVERY:
-            result = readRecovery(ttbin, ap);
-            break;
+        break;
+    case TAG_SUMMARY: // summary at end.
+        result = readSummary(ttbin, ap);
+        break;
 
-        default:
+    case TAG_STATUS: // lap.
+        result = readStatus(ttbin, ap);
+        break;
+    case TAG_GPS: // GPS pos + cadence
+        result = readPosition(ttbin, ap, forgiving);
+        break;
+    case TAG_HEART_RATE: // heart rate on Cardio Models
+        result = readHeartRate(ttbin, ap);
+        break;
+    case TAG_TREADMILL:
+        result = readTreadmill(ttbin, ap);
+        break;
+    case TAG_SWIM:
+        result = readSwim(ttbin, ap);
+        break;
+    case TAG_ALTITUDE_UPDATE:
+        result = readAltitude(ttbin, ap);
+        break;
+    case TAG_HEART_RATE_RECOVERY:
+        result = readRecovery(ttbin, ap);
+        break;
 
-            if ( m_RecordLengths.contains( tag ) )
-            {
-                result = skipTag(ttbin, tag, m_RecordLengths[tag]);
-            }
-            else
-            {
-                result = false;
-                qWarning() << "TTBinReader::read / unknown tag, bailing out. " << QString::number(tag,16) << ttbin.pos();
-            }
+    default:
+
+        if ( m_RecordLengths.contains( tag ) )
+        {
+            result = skipTag(ttbin, tag, m_RecordLengths[tag]);
         }
+        else
+        {
+            result = false;
+            qWarning() << "TTBinReader::read / unknown tag, bailing out. " << QString::number(tag,16) << m_Offset + ttbin.pos();
+        }
+    }
 
-        if ( !result && !forgiving )
+    if ( !result && !forgiving )
+    {
+        qWarning() << "TTBinReader::read / failed on tag, bailing out. " << QString::number(tag,16) << m_Offset + ttbin.pos();
+        return false;
+    }
+    return true;
+}
+
+ActivityPtr TTBinReader::read(QIODevice &ttbin, bool forgiving, bool headerAndSummaryOnly)
+{
+    if ( !ttbin.isOpen() )
+    {
+        return ActivityPtr();
+    }
+
+    m_RecordLengths.clear();
+    m_Offset = 0;
+
+    ActivityPtr ap = ActivityPtr::create();
+
+    while ( !ttbin.atEnd() )
+    {
+        if ( !readRecord(ttbin, ap, forgiving, headerAndSummaryOnly) )
         {
-            qWarning() << "TTBinReader::read / failed on tag, bailing out. " << QString::number(tag,16) << ttbin.pos();
             return ActivityPtr();
         }
     }
@@ -723,6 +737,99 @@ ActivityPtr TTBinReader::read(QIODevice &ttbin, bool forgiving, bool headerAndSu
     return ap;
 }
 
+void TTBinReader::begin(bool forgiving)
+{
+    m_RecordLengths.clear();
+    m_Offset = 0;
+    m_Pending.clear();
+    m_StreamForgiving = forgiving;
+    m_StreamActivity = ActivityPtr::create();
+}
+
+int TTBinReader::pendingRecordSize(int pos) const
+{
+    const quint8 * data = (const quint8*)m_Pending.constData() + pos;
+    int available = m_Pending.length() - pos;
+    quint8 tag = data[0];
+
+    if ( tag == TAG_FILE_HEADER && m_Offset + pos == 0 )
+    {
+        // the record length table follows the fixed part.
+        if ( available < 1 + 0x75 )
+        {
+            return -1;
+        }
+        return 1 + 0x75 + 3 * data[1 + 116];
+    }
+
+    if ( tag == TAG_FILE_HEADER || !m_RecordLengths.contains(tag) )
+    {
+        return 1;
+    }
+
+    // the forgiving check looks at the tag of the next record as well.
+    return 1 + m_RecordLengths[tag] + ( m_StreamForgiving ? 1 : 0 );
+}
+
+bool TTBinReader::parsePending(bool atEnd)
+{
+    QBuffer buffer(&m_Pending);
+    buffer.open(QIODevice::ReadOnly);
+
+    bool result = true;
+    while ( !buffer.atEnd() )
+    {
+        if ( !atEnd )
+        {
+            int size = pendingRecordSize(buffer.pos());
+            if ( size < 0 || buffer.pos() + size > m_Pending.length() )
+            {
+                break; // wait for the rest of the record.
+            }
+        }
+
+        if ( !readRecord(buffer, m_StreamActivity, m_StreamForgiving, false) )
+        {
+            m_StreamActivity.clear();
+            result = false;
+            break;
+        }
+    }
+
+    int consumed = buffer.pos();
+    buffer.close();
+    m_Offset += consumed;
+    m_Pending.remove(0, consumed);
+    return result;
+}
+
+bool TTBinReader::feed(const QByteArray &data)
+{
+    if ( !m_StreamActivity )
+    {
+        return false;
+    }
+
+    m_Pending.append(data);
+    return parsePending(false);
+}
+
+ActivityPtr TTBinReader::finish()
+{
+    if ( m_StreamActivity && parsePending(true) )
+    {
+        foreach ( LapPtr lap, m_StreamActivity->laps() )
+        {
+            lap->calcTotals();
+        }
+    }
+
+    ActivityPtr ap = m_StreamActivity;
+    m_StreamActivity.clear();
+    m_Pending.clear();
+    return ap;
+}
+
 ActivityPtr TTBinReader::read(const QString &filename, bool forgiving, bool headerAndSummaryOnly)
 {
     QFile f(filename);
@@ -12,6 +12,12 @@ class TTBinReader
 {
     QMap<quint8, quint16> m_RecordLengths;
     qint32 m_UTCOffset;
+    qint64 m_Offset; // file position of the device start, non zero while streaming
+
+    // streaming state, see begin().
+    QByteArray m_Pending;
+    ActivityPtr m_StreamActivity;
+    bool m_StreamForgiving;
 
 
     bool readData( QIODevice & ttbin, quint8 tag, int expectedSize, QByteArray & dest );
@@ -27,6 +33,9 @@ class TTBinReader
     bool readRecovery(QIODevice &ttbin, ActivityPtr activity);
 
     bool skipTag(QIODevice & ttbin, quint8 tag, int size , QByteArray *cpy = 0);
+    bool readRecord( QIODevice & ttbin, ActivityPtr activity, bool forgiving, bool headerAndSummaryOnly );
+    int pendingRecordSize( int pos ) const;
+    bool parsePending( bool atEnd );
 
 public:
     TTBinReader();
@@ -37,6 +46,13 @@ public:
     ActivityPtr read( QIODevice & ttbin, bool forgiving = false, bool headerAndSummaryOnly = false );
     ActivityPtr read( const QString &filename, bool forgiving = false, bool headerAndSummaryOnly = false );
 
+    // incremental reading, for data that is still arriving. feed() parses
+    // every record that is complete and keeps the rest for the next call,
+    // finish() parses what is left and returns the activity.
+    void begin( bool forgiving = false );
+    bool feed( const QByteArray & data );
+    ActivityPtr finish();
+
 
     static quint16 readquint16(const quint8 * data, int pos );
     static quint32 readquint32(const quint8 * data, int pos );
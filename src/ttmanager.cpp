@@ -3,12 +3,22 @@
 #include <QDebug>
 #include <QDir>
 #include <QFile>
+#include <QSaveFile>
 #include <QDirIterator>
 #include <QStandardPaths>
 #include <QBuffer>
 #include <QRegExp>
+#include <QDateTime>
 #include "hidapi.h"
 #include "watchexporters.h"
+#include "hidwatchtransport.h"
+#include "watchrecorder.h"
+#ifdef Q_OS_LINUX
+#include "netlinkhotplugsource.h"
+#endif
+
+#define TT_VENDOR_ID 0x1390
+#define TT_PRODUCT_ID 0x7474
 
 void TTManager::checkvds(quint16 vid, const DeviceIdList &deviceIds)
 {
@@ -16,7 +26,10 @@ void TTManager::checkvds(quint16 vid, const DeviceIdList &deviceIds)
     QStringList currentPaths;
     foreach ( const TTWatch * watch, m_TTWatchList )
     {
-        currentPaths.append( watch->path() );
+        if ( watch->isDevice() )
+        {
+            currentPaths.append( watch->path() );
+        }
     }
 
 
@@ -39,10 +52,14 @@ void TTManager::checkvds(quint16 vid, const DeviceIdList &deviceIds)
                 }
                 else
                 {
-                    TTWatch * newWatch = new TTWatch( path, serial, this );
-                    m_TTWatchList.append( newWatch );
-                    prepareWatch( newWatch );
-                    emit ttArrived(serial);
+                    IWatchTransport * transport = new HidWatchTransport( path );
+                    if ( !m_RecordDir.isEmpty() )
+                    {
+                        QString recording = QString("%1/%2-%3.ttrec").arg(m_RecordDir).arg(serial)
+                                .arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"));
+                        transport = new RecordingWatchTransport( transport, recording );
+                    }
+                    addWatch( new TTWatch( transport, path, serial, this ) );
                 }
 
             }
@@ -66,13 +83,122 @@ void TTManager::checkvds(quint16 vid, const DeviceIdList &deviceIds)
 
     foreach ( TTWatch * w, wl )
     {        
-        m_TTWatchList.removeOne(w);
-        w->deleteLater();
+        deleteWatch(w);
     }
 
 }
 
 void TTManager::prepareWatch(TTWatch *watch)
+{
+    WatchWorker * w = new WatchWorker(watch);
+    connect(w, SIGNAL(fileChecked(quint32,QByteArray,bool,bool)), this, SLOT(onPreferencesRead(quint32,QByteArray,bool,bool)));
+    connect(w, SIGNAL(fileWritten(quint32,bool)), this, SLOT(onPreferencesWritten(quint32,bool)));
+    m_Workers.insert(watch, w);
+
+    // the probe only decides whether the preferences are imported again, a
+    // change it misses waits for the next one it does see. Nothing is
+    // written back on the strength of it, see saveAllConfig.
+    m_PreferenceReads[watch].enqueue(false);
+    w->readFileIfChanged(FILE_PREFERENCES_XML, knownWatchPreferences(watch->serial()));
+}
+
+void TTManager::onPreferencesRead(quint32 fileId, QByteArray data, bool changed, bool ok)
+{
+    WatchWorker * w = qobject_cast<WatchWorker*>(sender());
+    if ( fileId != FILE_PREFERENCES_XML || !w || m_PreferenceReads.value(w->watch()).isEmpty() )
+    {
+        return;
+    }
+
+    TTWatch * watch = w->watch();
+    bool storeBack = m_PreferenceReads[watch].dequeue();
+
+    if ( ok && changed )
+    {
+        setKnownWatchPreferences(watch->serial(), data);
+    }
+
+    if ( !storeBack )
+    {
+        if ( ok )
+        {
+            // unchanged preferences went into the local config when they were last seen.
+            if ( changed || !m_WatchExporters.contains(watch->serial()) )
+            {
+                applyWatchPreferences(watch, data);
+            }
+        }
+        else
+        {
+            qCritical() << "TTManager::onPreferencesRead / could not load preferences from " << watch->serial();
+        }
+        emit ttArrived( watch->serial() );
+        return;
+    }
+
+    if ( !ok )
+    {
+        qCritical() << "TTManager::onPreferencesRead / could not load preferences from " << watch->serial();
+        return;
+    }
+
+    WatchExportersPtr watchExporters = exporters( watch->serial() );
+    QByteArray merged = mergeConfig(data, watchExporters->configMap());
+    setKnownWatchPreferences(watch->serial(), merged);
+    w->writeFile( merged, FILE_PREFERENCES_XML );
+}
+
+void TTManager::onPreferencesWritten(quint32 fileId, bool ok)
+{
+    WatchWorker * w = qobject_cast<WatchWorker*>(sender());
+    if ( fileId == FILE_PREFERENCES_XML && !ok )
+    {
+        qCritical() << "TTManager::onPreferencesWritten / could not save preferences to watch.";
+        if ( w )
+        {
+            // no telling what made it to the watch, read it all next time.
+            setKnownWatchPreferences(w->watch()->serial(), QByteArray());
+        }
+    }
+}
+
+QByteArray TTManager::knownWatchPreferences(const QString &serial)
+{
+    if ( !m_WatchPreferences.contains(serial) )
+    {
+        QFile f(configDir() + QDir::separator() + "watchFile_" + serial + ".xml");
+        if ( f.open(QIODevice::ReadOnly) )
+        {
+            m_WatchPreferences.insert(serial, f.readAll());
+        }
+        else
+        {
+            m_WatchPreferences.insert(serial, QByteArray());
+        }
+    }
+    return m_WatchPreferences.value(serial);
+}
+
+void TTManager::setKnownWatchPreferences(const QString &serial, const QByteArray &data)
+{
+    m_WatchPreferences.insert(serial, data);
+
+    // kept across runs, so the first arrival after a start can skip the transfer too.
+    QString filename = configDir() + QDir::separator() + "watchFile_" + serial + ".xml";
+    if ( data.isEmpty() )
+    {
+        QFile::remove(filename);
+        return;
+    }
+
+    QSaveFile f(filename);
+    if ( !f.open(QIODevice::WriteOnly) || f.write(data) != data.size() || !f.commit() )
+    {
+        qWarning() << "TTManager::setKnownWatchPreferences / could not write " << filename;
+    }
+}
+
+void TTManager::applyWatchPreferences(TTWatch *watch, const QByteArray &data)
 {
     // Settings rules.
     // Store settings on PC (this can include settings that do not appear on the actual watch.
@@ -83,68 +209,68 @@ void TTManager::prepareWatch(TTWatch *watch)
     if ( m_WatchExporters.contains( watch->serial() ))
     {
         WatchExportersPtr exp = exporters(watch->serial());
-        QByteArray data;
         bool mustSave = false;
 
-        if ( watch->downloadPreferences(data))
+        IExporterConfigMap configImportMap = exp->configImportMap();
+        QString name;
+        if (!loadConfig(data, configImportMap, name))
         {
-            IExporterConfigMap configImportMap = exp->configImportMap();
-            QString name;
-            if (!loadConfig(data, configImportMap, name))
-            {
-                return;
-            }
-            if ( exp->name() != name )
-            {
-                exp->setName(name);
-                mustSave = true;
-            }
-
-            // now compare with what we have.
-            IExporterConfigMap configMap = exp->configMap();
-            for(IExporterConfigMap::iterator i = configMap.begin(); i!=configMap.end();i++)
-            {
-                QString name = i.key();
-                IExporterConfig * config = i.value();
-                IExporterConfig * configImport = configImportMap[name];
-
-                if ( config->allowSaveOnWatch() && !config->equals( configImport ))
-                {
-                    config->apply( configImport );
-                    mustSave = true;
-                }
-            }
+            return;
+        }
+        if ( exp->name() != name )
+        {
+            exp->setName(name);
+            mustSave = true;
+        }
 
+        // now compare with what we have.
+        IExporterConfigMap configMap = exp->configMap();
+        for(IExporterConfigMap::iterator i = configMap.begin(); i!=configMap.end();i++)
+        {
+            QString name = i.key();
+            IExporterConfig * config = i.value();
+            IExporterConfig * configImport = configImportMap[name];
 
-            if ( mustSave )
+            if ( config->allowSaveOnWatch() && !config->equals( configImport ))
             {
-                saveConfig(exp);
+                config->apply( configImport );
+                mustSave = true;
             }
+        }
 
-            exp->freeImportMap(configImportMap);
+
+        if ( mustSave )
+        {
+            saveConfig(exp);
         }
+
+        exp->freeImportMap(configImportMap);
     }
     else
     {
         WatchExportersPtr exp = exporters(watch->serial()); // this will create the exporter if it didn't exist.
-        QByteArray data;
-        if ( watch->downloadPreferences(data))
+        QString name;
+        if ( loadConfig(data, exp->configMap(),name))
         {
-            QString name;
-            if ( loadConfig(data, exp->configMap(),name))
-            {
-                exp->setName(name);
-                saveConfig(exp);
-            }
+            exp->setName(name);
+            saveConfig(exp);
         }
     }
 }
 
 TTManager::TTManager(QObject *parent) :
-    QObject(parent)
+    QObject(parent),
+    m_HotplugSource(0)
 {
     loadAllConfig();
 
+#ifdef Q_OS_LINUX
+    m_HotplugSource = new NetlinkHotplugSource(TT_VENDOR_ID, this);
+#endif
+    m_HotplugDebounce.setSingleShot(true);
+    m_HotplugDebounce.setInterval(1000);
+    connect(&m_HotplugDebounce, SIGNAL(timeout()), this, SLOT(checkForTTs()));
+
     if ( hid_init() < 0 )
     {
         qCritical() << "TTManager::TTManager / could not initialize HID library.";
@@ -154,18 +280,72 @@ TTManager::TTManager(QObject *parent) :
 
 TTManager::~TTManager()
 {
+    // the workers use the watches, stop them first.
+    qDeleteAll(m_Workers);
+    m_Workers.clear();
     hid_exit();
 }
 
+void TTManager::deleteWatch(TTWatch *watch)
+{
+    m_TTWatchList.removeOne(watch);
+    m_PreferenceReads.remove(watch);
+
+    // the worker may be in the middle of a transfer, let it finish that on
+    // its own thread. Its queued answers find no pending reads anymore.
+    WatchWorker * w = m_Workers.take(watch);
+    if ( w )
+    {
+        w->shutdown();
+        // shutdown() drops all connections of the worker, this one comes after.
+        connect(w, SIGNAL(destroyed()), watch, SLOT(deleteLater()));
+    }
+    else
+    {
+        watch->deleteLater();
+    }
+}
+
 void TTManager::startSearch()
 {
-    QTimer * t = new QTimer(this);
-    t->setInterval(60000);
-    connect(t, SIGNAL(timeout()), this, SLOT(checkForTTs()));
-    t->start();
+    if ( m_HotplugSource && m_HotplugSource->start() )
+    {
+        connect(m_HotplugSource, SIGNAL(devicesChanged()), &m_HotplugDebounce, SLOT(start()));
+    }
+    else
+    {
+        qDebug() << "TTManager::startSearch / no hotplug events, polling for watches.";
+        QTimer * t = new QTimer(this);
+        t->setInterval(60000);
+        connect(t, SIGNAL(timeout()), this, SLOT(checkForTTs()));
+        t->start();
+    }
     checkForTTs();
 }
 
+void TTManager::setHotplugSource(IHotplugSource *source)
+{
+    delete m_HotplugSource;
+    m_HotplugSource = source;
+    if ( m_HotplugSource )
+    {
+        m_HotplugSource->setParent(this);
+    }
+}
+
+void TTManager::addWatch(TTWatch *watch)
+{
+    watch->setParent(this);
+    m_TTWatchList.append( watch );
+    // ttArrived follows once the preferences of the watch are in.
+    prepareWatch( watch );
+}
+
+void TTManager::setRecordDirectory(const QString &dir)
+{
+    m_RecordDir = dir;
+}
+
 const TTWatchList &TTManager::watches()
 {
     return m_TTWatchList;
@@ -183,6 +363,11 @@ TTWatch *TTManager::watch(const QString &serial)
     return 0;
 }
 
+WatchWorker *TTManager::worker(const QString &serial)
+{
+    return m_Workers.value( watch(serial) );
+}
+
 WatchExportersMap & TTManager::exporters()
 {
     return m_WatchExporters;
@@ -298,22 +483,14 @@ void TTManager::saveAllConfig(bool saveToWatch, const QString serialOnly)
 
         if ( saveToWatch )
         {
+            // merged and written back once they arrive, see onPreferencesRead.
+            // Always read in full, the probe can miss a change past its end and
+            // merging into a stale copy would overwrite it on the watch.
             TTWatch * w = watch( watchExporters->serial() );
-            if ( w )
+            if ( w && m_Workers.contains(w) )
             {
-                QByteArray prefData;
-                if ( !w->downloadPreferences(prefData))
-                {
-                    qCritical() << "TTManager::saveAllConfig / could not load preferences.";
-                    continue;
-                }
-
-                prefData = mergeConfig(prefData, configMap);
-
-                if ( !w->uploadPreferences(prefData) )
-                {
-                    qCritical() << "TTManager::saveAllConfig / could not save preferences to watch.";
-                }
+                m_PreferenceReads[w].enqueue(true);
+                m_Workers[w]->readFileIfChanged(FILE_PREFERENCES_XML, QByteArray());
             }
         }
     }
@@ -525,8 +702,7 @@ bool TTManager::remove(const QString &path)
         TTWatch * w = (*i);
         if ( w->path() == path )
         {
-            m_TTWatchList.erase(i);
-            w->deleteLater();
+            deleteWatch(w);
             return true;
         }
     }
@@ -536,8 +712,8 @@ bool TTManager::remove(const QString &path)
 void TTManager::checkForTTs()
 {
     DeviceIdList deviceIdList;
-    deviceIdList.append(0x7474);
-    checkvds(0x1390, deviceIdList);
+    deviceIdList.append(TT_PRODUCT_ID);
+    checkvds(TT_VENDOR_ID, deviceIdList);
 }
 
 void TTManager::configChanged(QString serial)
@@ -4,8 +4,12 @@
 #include <QObject>
 #include <QList>
 #include <QMap>
+#include <QQueue>
+#include <QTimer>
 #include "ttwatch.h"
+#include "watchworker.h"
 #include "watchexporters.h"
+#include "ihotplugsource.h"
 
 typedef QList<quint16> DeviceIdList;
 typedef QList<TTWatch*> TTWatchList;
@@ -16,9 +20,21 @@ class TTManager : public QObject
     Q_OBJECT
 
     TTWatchList m_TTWatchList;
+    QMap<TTWatch*, WatchWorker*> m_Workers;
+    // per watch, in request order: whether the preferences are read to be merged and stored back.
+    QMap<TTWatch*, QQueue<bool> > m_PreferenceReads;
+    // per serial, the preferences file as it was last seen on the watch.
+    QMap<QString, QByteArray> m_WatchPreferences;
     WatchExportersMap m_WatchExporters;
+    QString m_RecordDir;
+    IHotplugSource * m_HotplugSource;
+    QTimer m_HotplugDebounce; // a device comes with a burst of events and needs a moment to settle.
     void checkvds(quint16 vid, const DeviceIdList & deviceIds );
     void prepareWatch ( TTWatch * watch );
+    void applyWatchPreferences( TTWatch * watch, const QByteArray & data );
+    QByteArray knownWatchPreferences( const QString & serial );
+    void setKnownWatchPreferences( const QString & serial, const QByteArray & data );
+    void deleteWatch( TTWatch * watch );
 
     TTWatch * find( const QString & path );
     bool remove( const QString & path );
@@ -26,9 +42,19 @@ public:
 
     explicit TTManager(QObject *parent = 0);
     virtual ~TTManager();
+    // enumerates the watches whenever the hotplug source reports a change,
+    // every minute where there is none.
     void startSearch();
+    // replaces the platform's hotplug source, call before startSearch(). Takes ownership.
+    void setHotplugSource( IHotplugSource * source );
+    // watches that are not found on the USB bus, like a simulated watch.
+    void addWatch( TTWatch * watch );
+    // record the traffic of every watch that arrives from now on.
+    void setRecordDirectory( const QString & dir );
     const TTWatchList & watches();
     TTWatch * watch( const QString & serial );
+    // all traffic with a watch goes through its worker.
+    WatchWorker * worker( const QString & serial );
 
     WatchExportersMap &exporters();
     WatchExportersPtr exporters( const QString & serial );
@@ -69,6 +95,8 @@ public slots:
 
 private slots:
     void configChanged( QString serial );
+    void onPreferencesRead( quint32 fileId, QByteArray data, bool changed, bool ok );
+    void onPreferencesWritten( quint32 fileId, bool ok );
 
 };
 
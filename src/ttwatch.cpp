@@ -11,26 +11,9 @@
 #include <QEventLoop>
 
 #include "ttbinreader.h"
+#include "partialdownload.h"
 #include "tcxexport.h"
-
-#define TT_CREATE_FILE          0x02
-#define TT_DELETE_FILE          0x03
-#define TT_WRITE_FILE           0x04
-
-#define TT_GET_FILE_SIZE        0x05
-#define TT_OPEN_FILE_READ       0x06
-#define TT_READ_FILE            0x07
-#define TT_CLOSE_FILE           0x0C
-
-#define TT_READ_FIRST           0x11
-#define TT_READ_NEXT            0x12
-
-#define TT_READ_TIME            0x14  // responds with Unix Timestamp 01 16 CB 14 54 DA 15 80 ( time was 54DA15BC )
-#define TT_RESET                0x1D // ???
-#define TT_GET_VERSION          0x21 // responds with 01 08 07 21 31 2E 38 2E 32 35 radix: ascii: ...!1.8.25
-
-#define TT_GET_BATTERY_LEVEL    0x23
-#define TT_RESET_GPS_PROCESSOR  0x1d
+#include "hidwatchtransport.h"
 
 
 /* File 00010100 contains GPS Quickfix data.
@@ -57,10 +40,27 @@ quint32 TTWatch::readquint32(const QByteArray &data, int offset) const
 
 bool TTWatch::sendCommand(const QByteArray &command, QByteArray &response)
 {
-    response.clear();
+    quint8 counter;
+    if ( !writeCommand(command, counter) )
+    {
+        response.clear();
+        return false;
+    }
+
+    return readResponse(response, counter, 1000);
+}
+
+bool TTWatch::writeCommand(const QByteArray &command, quint8 &counter)
+{
+    if ( !m_Transport->isOpen() )
+    {
+        qDebug() << "TTWatch::writeCommand / not open";
+        return false;
+    }
+
     if ( command.length() > 60 )
     {
-        qDebug() << "TTWatch::sendCommand / too long";
+        qDebug() << "TTWatch::writeCommand / too long";
         return false;
     }
 
@@ -68,29 +68,33 @@ bool TTWatch::sendCommand(const QByteArray &command, QByteArray &response)
     memset(data,0, 64);
     data[0] = 9; // report
     data[1] = command.length()+1;
-    data[2] = m_Counter++;
+    data[2] = counter = m_Counter++;
     memcpy(data+3, command.data(), command.length());
 
 
-    if ( hid_write( m_Device, data, 64) < 64 )
+    if ( m_Transport->write( data, 64) < 64 )
     {
-        qDebug() << "TTWatch::sendCommand / write failed.";
+        qDebug() << "TTWatch::writeCommand / write failed.";
         return false;
     }
 
+    return true;
+}
+
+bool TTWatch::readResponse(QByteArray &response, quint8 &counter, int timeoutMs)
+{
     response.resize(64);
 
-    if ( hid_read_timeout( m_Device, (unsigned char*)response.data(), 64,1000) < 64 )
+    if ( m_Transport->read( (quint8*)response.data(), 64, timeoutMs) < 64 )
     {
-        qDebug() << "TTWatch::sendCommand / read failed.";
+        response.clear();
         return false;
     }
 
-    response = response.mid(3, response[1] );
+    counter = (quint8)response[2];
+    response = response.mid(3, (quint8)response[1] );
 
     return true;
-
-
 }
 
 void TTWatch::appendId(QByteArray &dest, const TTFile &file)
@@ -141,21 +145,51 @@ bool TTWatch::_openFile(TTFile &file)
     return true;
 }
 
-bool TTWatch::_readFile(QByteArray &dest, const TTFile &file, bool processEvents)
+bool TTWatch::_readFile(QByteArray &dest, const TTFile &file, quint32 pos)
 {
-    dest.clear();
-    const quint8 maxReadSize = 0x32;
-    QByteArray read, response;
-    buildCommand(read, TT_READ_FILE, file);
-
-    for ( quint32 pos = 0 ; pos < file.length; pos+= maxReadSize )
+    // appends the bytes from pos up to file.length to dest, pos has to be the
+    // read position of the open file, the watch can not seek.
+    if ( m_ReadWindow > 1 && file.length - pos > MAX_READ_SIZE )
     {
-        if ( pos > 0 && processEvents )
+        int kept = dest.length();
+        if ( _readFilePipelined(dest, file, pos) )
         {
-            //QCoreApplication::processEvents();
-            // macos doesn't handle this very well.
+            return true;
+        }
+
+        // the watch lost track, drop whatever is still underway and start
+        // over in lock-step, the read position is only reset by opening again.
+        qWarning() << "TTWatch::_readFile / pipelined read failed, falling back to lock-step reads.";
+        m_ReadWindow = 1;
+        dest.truncate(kept);
+
+        QByteArray stale;
+        quint8 counter;
+        while ( readResponse(stale, counter, 100) )
+        {
+        }
+
+        TTFile reopened = file;
+        _closeFile(file);
+        if ( !_openFile(reopened) )
+        {
+            return false;
+        }
+
+        TTFile skip = file;
+        skip.length = pos;
+        if ( !_readFile(stale, skip, 0) )
+        {
+            return false;
         }
+    }
 
+    const quint8 maxReadSize = MAX_READ_SIZE;
+    QByteArray read, response;
+    buildCommand(read, TT_READ_FILE, file);
+
+    for ( ; pos < file.length; pos+= maxReadSize )
+    {
         quint8 len = qMin( (quint32)maxReadSize, quint32(file.length - pos) );
         read[7] = (char)len;
 
@@ -179,6 +213,69 @@ bool TTWatch::_readFile(QByteArray &dest, const TTFile &file, bool processEvents
     return true;
 }
 
+bool TTWatch::_readFilePipelined(QByteArray &dest, const TTFile &file, quint32 pos)
+{
+    // up to m_ReadWindow reads are in flight, responses are matched on the
+    // sequence counter and appended in the order the reads were sent.
+    struct Chunk
+    {
+        quint8 counter;
+        quint8 length;
+        bool done;
+        QByteArray data;
+    };
+    QList<Chunk> inFlight;
+
+    QByteArray read, response;
+    buildCommand(read, TT_READ_FILE, file);
+
+    quint32 requested = pos;
+    while ( pos < file.length )
+    {
+        while ( inFlight.count() < m_ReadWindow && requested < file.length )
+        {
+            Chunk chunk;
+            chunk.length = qMin( (quint32)MAX_READ_SIZE, quint32(file.length - requested) );
+            chunk.done = false;
+            read[7] = (char)chunk.length;
+            if ( !writeCommand(read, chunk.counter) )
+            {
+                return false;
+            }
+            inFlight.append(chunk);
+            requested += chunk.length;
+        }
+
+        quint8 counter;
+        if ( !readResponse(response, counter, 1000) )
+        {
+            qWarning() << "TTWatch::_readFilePipelined / read failed. pos = " << pos;
+            return false;
+        }
+
+        int i = 0;
+        while ( i < inFlight.count() && ( inFlight.at(i).counter != counter || inFlight.at(i).done ) )
+        {
+            i++;
+        }
+        if ( i == inFlight.count() || response.length() < 9 || (quint8)response[8] != inFlight.at(i).length )
+        {
+            qWarning() << "TTWatch::_readFilePipelined / unexpected response. pos = " << pos << " counter = " << counter;
+            return false;
+        }
+
+        inFlight[i].done = true;
+        inFlight[i].data = response.mid(9, inFlight.at(i).length);
+        while ( !inFlight.isEmpty() && inFlight.first().done )
+        {
+            pos += inFlight.first().length;
+            dest.append(inFlight.takeFirst().data);
+        }
+    }
+
+    return true;
+}
+
 bool TTWatch::_createFile(const TTFile &file)
 {
     QByteArray createFile,response;
@@ -196,7 +293,7 @@ bool TTWatch::_createFile(const TTFile &file)
     return true;
 }
 
-bool TTWatch::_writeFile(const QByteArray &source, const TTFile &file, bool processEvents)
+bool TTWatch::_writeFile(const QByteArray &source, const TTFile &file)
 {
     if ( file.length != source.length() )
     {
@@ -211,9 +308,14 @@ bool TTWatch::_writeFile(const QByteArray &source, const TTFile &file, bool proc
 
     for ( int pos = 0 ; pos < source.length(); pos+= maxWriteSize )
     {
-        if ( pos > 0 && processEvents )
+        if ( pos % DOWNLOAD_SEGMENT < maxWriteSize )
         {
-            QCoreApplication::processEvents();
+            if ( isCancelled() )
+            {
+                qWarning() << "TTWatch::_writeFile / cancelled. pos = " << pos;
+                return false;
+            }
+            emit progress(file.id, pos, file.length);
         }
 
         quint8 len = qMin( (quint32)maxWriteSize, quint32(source.length() - pos) );
@@ -228,6 +330,7 @@ bool TTWatch::_writeFile(const QByteArray &source, const TTFile &file, bool proc
         }
     }
 
+    emit progress(file.id, file.length, file.length);
     return true;
 
 }
@@ -262,14 +365,30 @@ TTWatch::TTWatch(const QString &path, const QString &serial, QObject *parent) :
     QObject(parent),
     m_Path(path),
     m_Serial(serial),
-    m_Device(0),
-    m_Counter(1)
+    m_Transport(new HidWatchTransport(path)),
+    m_Counter(1),
+    m_ReadWindow(READ_WINDOW),
+    m_Lock(QMutex::Recursive),
+    m_Cancelled(0)
+{
+}
+
+TTWatch::TTWatch(IWatchTransport *transport, const QString &path, const QString &serial, QObject *parent) :
+    QObject(parent),
+    m_Path(path),
+    m_Serial(serial),
+    m_Transport(transport),
+    m_Counter(1),
+    m_ReadWindow(READ_WINDOW),
+    m_Lock(QMutex::Recursive),
+    m_Cancelled(0)
 {
 }
 
 TTWatch::~TTWatch()
 {
     close();
+    delete m_Transport;
 }
 
 QString TTWatch::path() const
@@ -284,30 +403,53 @@ QString TTWatch::serial() const
 
 bool TTWatch::open()
 {
-    if ( m_Device )
+    if ( m_Transport->isOpen() )
     {
         return true;
     }
 
-    m_Device = hid_open_path( m_Path.toLocal8Bit().data() );
     m_Counter = 0;
-    return ( m_Device != 0 );
+    return m_Transport->open();
 }
 
 bool TTWatch::isOpen() const
 {
-    return m_Device != 0;
+    return m_Transport->isOpen();
+}
+
+void TTWatch::setReadWindow(int window)
+{
+    m_ReadWindow = qBound(1, window, 32);
+}
+
+bool TTWatch::isDevice() const
+{
+    return m_Transport->isDevice();
+}
+
+void TTWatch::cancel()
+{
+    m_Cancelled.store(1);
+}
+
+void TTWatch::clearCancel()
+{
+    m_Cancelled.store(0);
+}
+
+bool TTWatch::isCancelled() const
+{
+    return m_Cancelled.load() != 0;
 }
 
 bool TTWatch::close()
 {
-    if ( m_Device == 0 )
+    if ( !m_Transport->isOpen() )
     {
         return false;
     }
 
-    hid_close(m_Device);
-    m_Device = 0;
+    m_Transport->close();
 
     return true;
 }
@@ -387,12 +529,20 @@ bool TTWatch::deleteFile(quint32 fileId)
     return _deleteFile(f);
 }
 
-bool TTWatch::readFile(QByteArray &data, quint32 fileId, bool processEvents)
+bool TTWatch::readFile(QByteArray &data, quint32 fileId)
 {
+    bool changed;
+    return readFileIfChanged(data, fileId, QByteArray(), changed);
+}
+
+bool TTWatch::readFileIfChanged(QByteArray &data, quint32 fileId, const QByteArray &known, bool &changed)
+{
+    changed = true;
+
     WatchOpener wo(this);
     if ( !wo.open() )
     {
-        qWarning() << "TTWatch::readFile / failed to open.";
+        qWarning() << "TTWatch::readFileIfChanged / failed to open.";
         return false;
     }
 
@@ -405,14 +555,46 @@ bool TTWatch::readFile(QByteArray &data, quint32 fileId, bool processEvents)
         return false;
     }
 
-    bool result = _readFile(data, f, processEvents);
+    data.clear();
+    bool result = true;
+
+    // the watch can not seek, a probe that differs is simply the start of the full read.
+    if ( !known.isEmpty() && f.length == (quint32)known.length() )
+    {
+        TTFile probe = f;
+        probe.length = qMin( (quint32)FILE_PROBE_SIZE, f.length );
+        result = _readFile(data, probe, 0);
+        if ( result && data == known.left(probe.length) )
+        {
+            qDebug() << "TTWatch::readFileIfChanged / " << hex << fileId << " unchanged.";
+            changed = false;
+            data = known;
+            _closeFile(f);
+            return true;
+        }
+    }
+
+    while ( result && (quint32)data.length() < f.length )
+    {
+        if ( isCancelled() )
+        {
+            qWarning() << "TTWatch::readFileIfChanged / cancelled " << fileId;
+            result = false;
+            break;
+        }
+
+        TTFile segment = f;
+        segment.length = qMin( data.length() + (quint32)DOWNLOAD_SEGMENT, f.length );
+        result = _readFile(data, segment, data.length());
+        emit progress(fileId, data.length(), f.length);
+    }
 
     _closeFile(f);
 
     return result;
 }
 
-bool TTWatch::writeFile(const QByteArray &source, quint32 fileId, bool processEvents)
+bool TTWatch::writeFile(const QByteArray &source, quint32 fileId)
 {
     WatchOpener wo(this);
     if ( !wo.open() )
@@ -430,7 +612,7 @@ bool TTWatch::writeFile(const QByteArray &source, quint32 fileId, bool processEv
         return false;
     }
 
-    bool result = _writeFile(source, f, processEvents);
+    bool result = _writeFile(source, f);
 
     _closeFile(f);
 
@@ -469,7 +651,7 @@ bool TTWatch::downloadPreferences(QByteArray &data)
         return false;
     }
 
-    if ( readFile(data, FILE_PREFERENCES_XML, true ) )
+    if ( readFile(data, FILE_PREFERENCES_XML) )
     {
         return true;
     }
@@ -481,7 +663,7 @@ bool TTWatch::downloadPreferences(QByteArray &data)
 
 bool TTWatch::uploadPreferences(const QByteArray &data)
 {
-    return writeFile(data, FILE_PREFERENCES_XML, true);
+    return writeFile(data, FILE_PREFERENCES_XML);
 }
 
 bool TTWatch::postGPSFix()
@@ -499,7 +681,21 @@ bool TTWatch::postGPSFix()
 }
 
 
-QStringList TTWatch::download(const QString &basePath, bool deleteWhenDone)
+QString TTWatch::workoutFilename(const QString &basePath, const QByteArray &header)
+{
+    const quint8 * data = (const quint8*) header.data();
+
+    if ( header.length() < 12 || !( data[0] == 0x20 && data[1] >= 0x05 ))
+    {
+        return QString();
+    }
+
+    QDateTime t = TTBinReader::readTime(data, 8, true);
+    QString exportPath = basePath + QDir::separator() + t.date().toString("yyyy-MM-dd");
+    return exportPath + QDir::separator() + "workout-" + t.time().toString("hh_mm") + ".ttbin";
+}
+
+QStringList TTWatch::download(const QString &basePath, bool deleteWhenDone, ActivityList *activities)
 {
     QStringList files;
 
@@ -519,63 +715,127 @@ QStringList TTWatch::download(const QString &basePath, bool deleteWhenDone)
 
     foreach ( const TTFile & file, fl)
     {
+        if ( isCancelled() )
+        {
+            break;
+        }
+
         if (! (( ( file.id & FILE_TYPE_MASK) == FILE_TTBIN_DATA ) && file.length > 100 ) )
         {
             // qDebug() << QString("Not Downloading %1, len = %2").arg(QString::number(file.id,16)).arg(file.length);
             continue;
         }
 
-        QByteArray fileData;
+        TTFile openFile = file;
+        if ( !_openFile(openFile) )
+        {
+            qWarning() << "TTWatch::download / failed to open " << file.id;
+            continue;
+        }
 
-        if ( !readFile( fileData, file.id, true ) )
+        // the header names the file, read it on its own first so workouts we
+        // already have are not transferred again.
+        QByteArray chunk;
+        TTFile header = openFile;
+        header.length = qMin( (quint32)MAX_READ_SIZE, openFile.length );
+        if ( !_readFile( chunk, header, 0 ) )
         {
-            qWarning() << "TTWatch::download / failed to download " << file.id;
+            qWarning() << "TTWatch::download / failed to read header of " << file.id;
+            _closeFile(openFile);
             continue;
         }
 
-        if ( fileData.length() < fl.size() )
+        QString filename = workoutFilename(basePath, chunk);
+        if ( filename.isEmpty() )
         {
-            qWarning() << "TTWatch::download / no data in file " << file.id;
+            qWarning() << "TTWatch::download / not a ttbin file " << file.id;
+            _closeFile(openFile);
             continue;
         }
 
-        const quint8 * data = (const quint8*) fileData.data();
+        QFileInfo fi(filename);
 
-        if (!( data[0] == 0x20 && data[1] >= 0x05 ))
+        if ( fi.exists() && fi.size() == openFile.length )
         {
-            qWarning() << "TTWatch::download / not a ttbin file " << file.id;
+            qWarning() << "TTWatch::download / file already exists. " << filename << file.id;
+            _closeFile(openFile);
             continue;
         }
 
-        QDateTime t = TTBinReader::readTime(data, 8, true);
-        QString exportPath = basePath + QDir::separator() + t.date().toString("yyyy-MM-dd");
-        QDir d;
-        if (!d.mkpath(exportPath))
+        if (!QDir().mkpath(fi.path()))
         {
-            qWarning() << "TTWatch::download / could not save in path " << exportPath;
+            qWarning() << "TTWatch::download / could not save in path " << fi.path();
+            _closeFile(openFile);
             continue;
         }
 
-        QString filename = exportPath + QDir::separator() + "workout-" + t.time().toString("hh_mm") + ".ttbin";
+        PartialDownload partial(filename, file.id, openFile.length);
+        if ( !partial.open() )
+        {
+            _closeFile(openFile);
+            continue;
+        }
 
-        QFileInfo fi(filename);
+        // every segment goes to disk and through the parser as it arrives,
+        // an interrupted transfer keeps what came in.
+        TTBinReader parser;
+        if ( activities )
+        {
+            parser.begin(true);
+        }
 
-        if ( fi.exists() && fi.size() == file.length )
+        quint32 pos = 0;
+        bool result = true;
+        while ( result )
         {
-            qWarning() << "TTWatch::download / file already exists. " << filename << file.id;
-            continue;
+            result = partial.receive(pos, chunk);
+            if ( activities )
+            {
+                parser.feed(chunk);
+            }
+            pos += chunk.length();
+            emit progress(file.id, pos, openFile.length);
+
+            if ( !result || pos >= openFile.length )
+            {
+                break;
+            }
+
+            if ( isCancelled() )
+            {
+                qWarning() << "TTWatch::download / cancelled " << file.id;
+                result = false;
+                break;
+            }
+
+            TTFile segment = openFile;
+            segment.length = qMin( pos + (quint32)DOWNLOAD_SEGMENT, openFile.length );
+            chunk.clear();
+            result = _readFile( chunk, segment, pos );
         }
+        _closeFile(openFile);
 
-        QFile f(filename);
+        if ( !result )
+        {
+            qWarning() << "TTWatch::download / failed to download " << file.id << ", kept " << partial.done() << " of " << openFile.length << " bytes for the next attempt.";
+            continue;
+        }
 
-        if ( !f.open( QIODevice::WriteOnly ))
+        if ( !partial.commit() )
         {
-            qWarning() << "TTWatch::download / could not open file " << filename;
+            partial.discard();
             continue;
         }
 
-        f.write(fileData);
-        f.close();
+        if ( activities )
+        {
+            ActivityPtr activity = parser.finish();
+            if ( activity )
+            {
+                activity->setFilename(filename);
+            }
+            activities->append(activity);
+        }
 
         files.append(filename);
 
@@ -5,11 +5,39 @@
 #include <QList>
 #include <QUrl>
 #include <QStringList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
 
-#include "hidapi.h"
+#include "iwatchtransport.h"
+#include "activity.h"
 
 
 
+#define TT_CREATE_FILE          0x02
+#define TT_DELETE_FILE          0x03
+#define TT_WRITE_FILE           0x04
+
+#define TT_GET_FILE_SIZE        0x05
+#define TT_OPEN_FILE_READ       0x06
+#define TT_READ_FILE            0x07
+#define TT_CLOSE_FILE           0x0C
+
+#define TT_READ_FIRST           0x11
+#define TT_READ_NEXT            0x12
+
+#define TT_READ_TIME            0x14  // responds with Unix Timestamp 01 16 CB 14 54 DA 15 80 ( time was 54DA15BC )
+#define TT_RESET                0x1D // ???
+#define TT_GET_VERSION          0x21 // responds with 01 08 07 21 31 2E 38 2E 32 35 radix: ascii: ...!1.8.25
+
+#define TT_GET_BATTERY_LEVEL    0x23
+#define TT_RESET_GPS_PROCESSOR  0x1d
+
+#define MAX_READ_SIZE           0x32 // bytes per TT_READ_FILE
+#define READ_WINDOW             8
+#define DOWNLOAD_SEGMENT        0x4000 // bytes between checkpoints, progress reports and cancel checks
+#define FILE_PROBE_SIZE         0x100 // bytes compared by readFileIfChanged
+
 #define FILE_SYSTEM_FIRMWARE        (0x000000f0)
 #define FILE_GPSQUICKFIX_DATA       (0x00010100)
 #define FILE_GPS_FIRMWARE           (0x00010200)
@@ -29,33 +57,42 @@ typedef struct ttfile {
     quint32 length;
 } TTFile;
 typedef QList<TTFile> TTFileList;
+Q_DECLARE_METATYPE( TTFileList )
 
 class TTWatch : public QObject
 {
     Q_OBJECT
     QString m_Path;
     QString m_Serial;
-    hid_device * m_Device;
+    IWatchTransport * m_Transport;
     quint8 m_Counter;
+    int m_ReadWindow; // read commands kept in flight, 1 for lock-step
+    QMutex m_Lock; // held by WatchOpener, one operation at a time
+    QAtomicInt m_Cancelled;
 
     quint32 readquint32( const QByteArray &data, int offset ) const;
     bool sendCommand( const QByteArray & command, QByteArray & response );
+    bool writeCommand( const QByteArray & command, quint8 & counter );
+    bool readResponse( QByteArray & response, quint8 & counter, int timeoutMs );
     static void appendId( QByteArray & dest, const TTFile & file);
 
     static void buildCommand(QByteArray &dest, quint8 command, const TTFile & file);
+    static QString workoutFilename( const QString & basePath, const QByteArray & header );
 
     bool _openFile( TTFile & file );
-    bool _readFile( QByteArray &dest, const TTFile & file, bool processEvents = false );
+    bool _readFile( QByteArray &dest, const TTFile & file, quint32 pos );
+    bool _readFilePipelined( QByteArray &dest, const TTFile & file, quint32 pos );
     bool _createFile(const TTFile &file );
-    bool _writeFile( const QByteArray & source, const TTFile & file, bool processEvents = false);
+    bool _writeFile( const QByteArray & source, const TTFile & file );
     bool _closeFile( const TTFile & file );
     bool _deleteFile( const TTFile & file );
 
     class WatchOpener {
         TTWatch * m_Watch;
         bool m_ShouldClose;
+        QMutexLocker m_Locker;
     public:
-        WatchOpener( TTWatch * watch ) : m_Watch(watch), m_ShouldClose(false) {
+        WatchOpener( TTWatch * watch ) : m_Watch(watch), m_ShouldClose(false), m_Locker(&watch->m_Lock) {
 
         }
         ~WatchOpener() {
@@ -85,6 +122,8 @@ class TTWatch : public QObject
 
 public:
     explicit TTWatch(const QString & path, const QString & serial, QObject *parent = 0);
+    // takes ownership of transport, path only identifies the watch.
+    TTWatch(IWatchTransport * transport, const QString & path, const QString & serial, QObject *parent = 0);
     virtual ~TTWatch();
 
     QString path() const;
@@ -92,11 +131,17 @@ public:
 
     bool open();
     bool isOpen() const;
+    bool isDevice() const;
     bool close();
+    void setReadWindow( int window );
     bool listFiles( TTFileList & fl );
     bool deleteFile( quint32 fileId );
-    bool readFile(QByteArray & data , quint32 fileId, bool processEvents = false);
-    bool writeFile(const QByteArray & source, quint32 fileId, bool processEvents = false);
+    bool readFile(QByteArray & data , quint32 fileId);
+    // like readFile, but when the file on the watch has the length of known
+    // and starts with the same FILE_PROBE_SIZE bytes only those are read,
+    // data becomes known and changed false.
+    bool readFileIfChanged( QByteArray & data, quint32 fileId, const QByteArray & known, bool & changed );
+    bool writeFile(const QByteArray & source, quint32 fileId);
     int batteryLevel();    
 
     bool downloadPreferences( QByteArray & data );
@@ -104,7 +149,19 @@ public:
     bool postGPSFix();
 
     // convenience functions
-    QStringList download( const QString & basePath, bool deleteWhenDone );
+    // when activities is given it receives the parsed workout for every file
+    // returned, or a null pointer where parsing failed.
+    QStringList download( const QString & basePath, bool deleteWhenDone, ActivityList * activities = 0 );
+
+    // safe to call from any thread, makes the running transfer stop at its
+    // next segment. Stays in effect until clearCancel().
+    void cancel();
+    void clearCancel();
+    bool isCancelled() const;
+
+signals:
+    // emitted from the thread doing the transfer.
+    void progress( quint32 fileId, qint64 done, qint64 total );
 
 private slots:
 
@@ -56,13 +56,26 @@ SOURCES += main.cpp\
     exportworkingdialog.cpp \
     centeredexpmovavg.cpp \
     workouttreemodel.cpp \
+    libraryindex.cpp \
+    workoutscanner.cpp \
+    workoutaggregates.cpp \
+    trainingload.cpp \
+    activitycache.cpp \
+    decodedactivity.cpp \
+    hidwatchtransport.cpp \
+    simulatedwatch.cpp \
+    watchrecorder.cpp \
+    partialdownload.cpp \
+    watchworker.cpp \
+    workoutpreparer.cpp \
     qtsingleapplication.cpp \
     qtlocalpeer.cpp \
     qtlockedfile.cpp
 
 win32:SOURCES+=hid.c qtlockedfile_win.cpp
-unix:linux:SOURCES+=hidlinux.c qtlockedfile_unix.cpp
+unix:linux:SOURCES+=hidlinux.c qtlockedfile_unix.cpp netlinkhotplugsource.cpp
 unix:macx:SOURCES+=hidmac.c qtlockedfile_unix.cpp
+unix:linux:HEADERS+=netlinkhotplugsource.h
 
 HEADERS  += mainwindow.h \
     hidapi.h \
@@ -103,6 +116,20 @@ HEADERS  += mainwindow.h \
     exportworkingdialog.h \
     centeredexpmovavg.h \
     workouttreemodel.h \
+    libraryindex.h \
+    workoutscanner.h \
+    workoutaggregates.h \
+    trainingload.h \
+    activitycache.h \
+    decodedactivity.h \
+    iwatchtransport.h \
+    hidwatchtransport.h \
+    simulatedwatch.h \
+    watchrecorder.h \
+    partialdownload.h \
+    watchworker.h \
+    workoutpreparer.h \
+    ihotplugsource.h \
     qtsingleapplication.h \
     qtlocalpeer.h \
     qtlockedfile.h
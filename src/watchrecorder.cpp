@@ -0,0 +1,196 @@
+#include "watchrecorder.h"
+
+#include <QThread>
+#include <QDebug>
+#include <string.h>
+
+#define RECORDING_MAGIC 0x54545243 // "TTRC"
+#define RECORDING_VERSION 1
+
+#define RECORD_WRITE 'W'
+#define RECORD_READ 'R'
+
+RecordingWatchTransport::RecordingWatchTransport(IWatchTransport *transport, const QString &filename) :
+    m_Transport(transport),
+    m_File(filename)
+{
+}
+
+RecordingWatchTransport::~RecordingWatchTransport()
+{
+    close();
+    delete m_Transport;
+    if ( m_File.isOpen() )
+    {
+        m_Stream.setDevice(0);
+        m_File.close();
+    }
+}
+
+bool RecordingWatchTransport::open()
+{
+    if ( !m_Transport->open() )
+    {
+        return false;
+    }
+
+    // the watch is opened and closed around every operation, the recording
+    // spans all of them and stays open until the transport goes.
+    if ( !m_File.isOpen() )
+    {
+        if ( !m_File.open(QIODevice::WriteOnly) )
+        {
+            qWarning() << "RecordingWatchTransport::open / could not write " << m_File.fileName() << m_File.errorString();
+        }
+        else
+        {
+            m_Stream.setDevice(&m_File);
+            m_Stream << quint32(RECORDING_MAGIC) << quint8(RECORDING_VERSION);
+        }
+    }
+    m_Clock.start();
+    return true;
+}
+
+void RecordingWatchTransport::close()
+{
+    m_Transport->close();
+    m_File.flush();
+}
+
+bool RecordingWatchTransport::isOpen() const
+{
+    return m_Transport->isOpen();
+}
+
+bool RecordingWatchTransport::isDevice() const
+{
+    return m_Transport->isDevice();
+}
+
+void RecordingWatchTransport::log(quint8 direction, const quint8 *report, int length)
+{
+    if ( m_File.isOpen() )
+    {
+        m_Stream << direction << qint64(m_Clock.nsecsElapsed() / 1000)
+                 << QByteArray((const char*)report, qMax(0, length));
+    }
+}
+
+int RecordingWatchTransport::write(const quint8 *report, int length)
+{
+    int result = m_Transport->write(report, length);
+    log(RECORD_WRITE, report, length);
+    return result;
+}
+
+int RecordingWatchTransport::read(quint8 *report, int length, int timeoutMs)
+{
+    int result = m_Transport->read(report, length, timeoutMs);
+    log(RECORD_READ, report, result);
+    return result;
+}
+
+ReplayWatchTransport::ReplayWatchTransport() :
+    m_Pos(0),
+    m_Open(false),
+    m_RealTime(false)
+{
+}
+
+bool ReplayWatchTransport::load(const QString &filename)
+{
+    QFile f(filename);
+    if ( !f.open(QIODevice::ReadOnly) )
+    {
+        qWarning() << "ReplayWatchTransport::load / could not open " << filename;
+        return false;
+    }
+
+    QDataStream ds(&f);
+    quint32 magic;
+    quint8 version;
+    ds >> magic >> version;
+    if ( magic != RECORDING_MAGIC || version != RECORDING_VERSION )
+    {
+        qWarning() << "ReplayWatchTransport::load / not a watch recording " << filename;
+        return false;
+    }
+
+    m_Records.clear();
+    while ( !ds.atEnd() && ds.status() == QDataStream::Ok )
+    {
+        Record r;
+        ds >> r.direction >> r.usecs >> r.report;
+        if ( ds.status() == QDataStream::Ok )
+        {
+            m_Records.append(r);
+        }
+    }
+    m_Pos = 0;
+    return true;
+}
+
+void ReplayWatchTransport::setRealTime(bool realTime)
+{
+    m_RealTime = realTime;
+}
+
+bool ReplayWatchTransport::open()
+{
+    m_Open = true;
+    m_Clock.start();
+    return true;
+}
+
+void ReplayWatchTransport::close()
+{
+    m_Open = false;
+}
+
+bool ReplayWatchTransport::isOpen() const
+{
+    return m_Open;
+}
+
+int ReplayWatchTransport::write(const quint8 *report, int length)
+{
+    if ( !m_Open || m_Pos >= m_Records.count() || m_Records.at(m_Pos).direction != RECORD_WRITE )
+    {
+        qWarning() << "ReplayWatchTransport::write / no write expected at record " << m_Pos;
+        return -1;
+    }
+
+    const Record & r = m_Records.at(m_Pos++);
+    if ( r.report != QByteArray((const char*)report, length) )
+    {
+        qWarning() << "ReplayWatchTransport::write / command differs from the recording at record " << m_Pos - 1;
+        return -1;
+    }
+    return length;
+}
+
+int ReplayWatchTransport::read(quint8 *report, int length, int timeoutMs)
+{
+    Q_UNUSED(timeoutMs);
+
+    if ( !m_Open || m_Pos >= m_Records.count() || m_Records.at(m_Pos).direction != RECORD_READ )
+    {
+        qWarning() << "ReplayWatchTransport::read / no read expected at record " << m_Pos;
+        return -1;
+    }
+
+    const Record & r = m_Records.at(m_Pos++);
+    if ( m_RealTime )
+    {
+        qint64 wait = r.usecs - m_Clock.nsecsElapsed() / 1000;
+        if ( wait > 0 )
+        {
+            QThread::usleep(wait);
+        }
+    }
+
+    int count = qMin(length, r.report.length());
+    memcpy(report, r.report.constData(), count);
+    return count;
+}
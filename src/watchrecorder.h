@@ -0,0 +1,69 @@
+#ifndef WATCHRECORDER_H
+#define WATCHRECORDER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QFile>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include "iwatchtransport.h"
+
+// Passes reports on to another transport and logs every one of them with its
+// timing, so a session with a real watch can be replayed later.
+class RecordingWatchTransport : public IWatchTransport
+{
+    IWatchTransport * m_Transport;
+    QFile m_File;
+    QDataStream m_Stream;
+    QElapsedTimer m_Clock;
+
+    void log( quint8 direction, const quint8 * report, int length );
+
+public:
+    // takes ownership of transport.
+    RecordingWatchTransport( IWatchTransport * transport, const QString & filename );
+    ~RecordingWatchTransport();
+
+    bool open();
+    void close();
+    bool isOpen() const;
+    bool isDevice() const;
+
+    int write( const quint8 * report, int length );
+    int read( quint8 * report, int length, int timeoutMs );
+};
+
+// Plays back a recording, the commands written have to match the recorded ones.
+class ReplayWatchTransport : public IWatchTransport
+{
+    struct Record
+    {
+        quint8 direction;
+        qint64 usecs;
+        QByteArray report;
+    };
+
+    QList<Record> m_Records;
+    int m_Pos;
+    bool m_Open;
+    bool m_RealTime;
+    QElapsedTimer m_Clock;
+
+public:
+    ReplayWatchTransport();
+
+    bool load( const QString & filename );
+    // keep the recorded timing instead of answering right away.
+    void setRealTime( bool realTime );
+
+    bool open();
+    void close();
+    bool isOpen() const;
+    bool isDevice() const { return false; }
+
+    int write( const quint8 * report, int length );
+    int read( quint8 * report, int length, int timeoutMs );
+};
+
+#endif // WATCHRECORDER_H
@@ -0,0 +1,169 @@
+#include "watchworker.h"
+
+#include <QMetaObject>
+#include <QCoreApplication>
+#include <QDebug>
+
+WatchWorker::WatchWorker(TTWatch *watch) :
+    m_Watch(watch),
+    m_Generation(0),
+    m_Stopped(0)
+{
+    qRegisterMetaType<TTFileList>("TTFileList");
+    qRegisterMetaType<ActivityList>("ActivityList");
+
+    // the watch emits on this thread, pass it on from there.
+    connect(m_Watch, SIGNAL(progress(quint32,qint64,qint64)), this, SIGNAL(progress(quint32,qint64,qint64)), Qt::DirectConnection);
+
+    // emitted on m_Thread as it ends, see shutdown().
+    connect(&m_Thread, SIGNAL(finished()), this, SLOT(onThreadFinished()), Qt::DirectConnection);
+
+    moveToThread(&m_Thread);
+    m_Thread.start();
+}
+
+WatchWorker::~WatchWorker()
+{
+    disconnect(&m_Thread, 0, this, 0);
+    cancel();
+    m_Thread.quit();
+    m_Thread.wait();
+}
+
+void WatchWorker::shutdown()
+{
+    m_Stopped.store(1);
+    cancel();
+    emit stopped();
+    disconnect(this, 0, 0, 0);
+    m_Thread.quit();
+}
+
+void WatchWorker::onThreadFinished()
+{
+    if ( !m_Stopped.load() )
+    {
+        return;
+    }
+
+    // the GUI thread deletes us after the signals already queued to it.
+    moveToThread(QCoreApplication::instance()->thread());
+    deleteLater();
+}
+
+TTWatch *WatchWorker::watch() const
+{
+    return m_Watch;
+}
+
+bool WatchWorker::start(int generation)
+{
+    if ( m_Stopped.load() || generation != m_Generation.load() )
+    {
+        qDebug() << "WatchWorker::start / request cancelled before it ran.";
+        return false;
+    }
+
+    // nothing else runs on this thread, whatever cancel() hit is done by now.
+    m_Watch->clearCancel();
+    return true;
+}
+
+void WatchWorker::cancel()
+{
+    m_Generation.ref();
+    m_Watch->cancel();
+}
+
+void WatchWorker::listFiles()
+{
+    QMetaObject::invokeMethod(this, "doListFiles", Qt::QueuedConnection,
+                              Q_ARG(int, m_Generation.load()));
+}
+
+void WatchWorker::readFile(quint32 fileId)
+{
+    QMetaObject::invokeMethod(this, "doReadFile", Qt::QueuedConnection,
+                              Q_ARG(int, m_Generation.load()), Q_ARG(quint32, fileId));
+}
+
+void WatchWorker::readFileIfChanged(quint32 fileId, const QByteArray &known)
+{
+    QMetaObject::invokeMethod(this, "doReadFileIfChanged", Qt::QueuedConnection,
+                              Q_ARG(int, m_Generation.load()), Q_ARG(quint32, fileId), Q_ARG(QByteArray, known));
+}
+
+void WatchWorker::writeFile(const QByteArray &data, quint32 fileId)
+{
+    QMetaObject::invokeMethod(this, "doWriteFile", Qt::QueuedConnection,
+                              Q_ARG(int, m_Generation.load()), Q_ARG(QByteArray, data), Q_ARG(quint32, fileId));
+}
+
+void WatchWorker::deleteFile(quint32 fileId)
+{
+    QMetaObject::invokeMethod(this, "doDeleteFile", Qt::QueuedConnection,
+                              Q_ARG(int, m_Generation.load()), Q_ARG(quint32, fileId));
+}
+
+void WatchWorker::download(const QString &basePath, bool deleteWhenDone)
+{
+    QMetaObject::invokeMethod(this, "doDownload", Qt::QueuedConnection,
+                              Q_ARG(int, m_Generation.load()), Q_ARG(QString, basePath), Q_ARG(bool, deleteWhenDone));
+}
+
+void WatchWorker::postGPSFix()
+{
+    QMetaObject::invokeMethod(this, "doPostGPSFix", Qt::QueuedConnection,
+                              Q_ARG(int, m_Generation.load()));
+}
+
+void WatchWorker::doListFiles(int generation)
+{
+    TTFileList fl;
+    bool ok = start(generation) && m_Watch->listFiles(fl);
+    emit filesListed(fl, ok);
+}
+
+void WatchWorker::doReadFile(int generation, quint32 fileId)
+{
+    QByteArray data;
+    bool ok = start(generation) && m_Watch->readFile(data, fileId);
+    emit fileRead(fileId, data, ok);
+}
+
+void WatchWorker::doReadFileIfChanged(int generation, quint32 fileId, QByteArray known)
+{
+    QByteArray data;
+    bool changed = true;
+    bool ok = start(generation) && m_Watch->readFileIfChanged(data, fileId, known, changed);
+    emit fileChecked(fileId, data, changed, ok);
+}
+
+void WatchWorker::doWriteFile(int generation, QByteArray data, quint32 fileId)
+{
+    bool ok = start(generation) && m_Watch->writeFile(data, fileId);
+    emit fileWritten(fileId, ok);
+}
+
+void WatchWorker::doDeleteFile(int generation, quint32 fileId)
+{
+    bool ok = start(generation) && m_Watch->deleteFile(fileId);
+    emit fileDeleted(fileId, ok);
+}
+
+void WatchWorker::doDownload(int generation, QString basePath, bool deleteWhenDone)
+{
+    QStringList files;
+    ActivityList activities;
+    if ( start(generation) )
+    {
+        files = m_Watch->download(basePath, deleteWhenDone, &activities);
+    }
+    emit downloaded(files, activities);
+}
+
+void WatchWorker::doPostGPSFix(int generation)
+{
+    bool ok = start(generation) && m_Watch->postGPSFix();
+    emit gpsFixPosted(ok);
+}
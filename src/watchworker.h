@@ -0,0 +1,74 @@
+#ifndef WATCHWORKER_H
+#define WATCHWORKER_H
+
+#include <QObject>
+#include <QThread>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QStringList>
+#include "ttwatch.h"
+
+// Runs the USB traffic of one watch on a thread of its own. Requests can be
+// made from any thread, they run one after the other in the order they were
+// made and their results come back as signals, so the GUI never waits on the
+// watch and never has to process events while a transfer is going on.
+class WatchWorker : public QObject
+{
+    Q_OBJECT
+    TTWatch * m_Watch;
+    QThread m_Thread;
+    QAtomicInt m_Generation; // bumped by cancel(), requests made before are dropped
+    QAtomicInt m_Stopped; // set by shutdown(), no request runs anymore
+
+    bool start( int generation );
+
+public:
+    // the watch stays owned by the caller and has to outlive the worker.
+    explicit WatchWorker( TTWatch * watch );
+    ~WatchWorker();
+
+    TTWatch * watch() const;
+
+    void listFiles();
+    void readFile( quint32 fileId );
+    // answers with fileChecked, see TTWatch::readFileIfChanged.
+    void readFileIfChanged( quint32 fileId, const QByteArray & known );
+    void writeFile( const QByteArray & data, quint32 fileId );
+    void deleteFile( quint32 fileId );
+    void download( const QString & basePath, bool deleteWhenDone );
+    void postGPSFix();
+
+    // stops the running request at its next segment and drops the queued
+    // ones, each still answers with its signal, failed.
+    void cancel();
+
+    // like cancel(), but without answers and for good. Returns right away,
+    // the worker deletes itself on the GUI thread once its running request
+    // is done, after the signals it emitted until then were delivered.
+    void shutdown();
+
+signals:
+    void filesListed( TTFileList files, bool ok );
+    void fileRead( quint32 fileId, QByteArray data, bool ok );
+    void fileChecked( quint32 fileId, QByteArray data, bool changed, bool ok );
+    void fileWritten( quint32 fileId, bool ok );
+    void fileDeleted( quint32 fileId, bool ok );
+    void downloaded( QStringList files, ActivityList activities );
+    void gpsFixPosted( bool ok );
+    // from shutdown(), on the thread calling it. Answers queued before may
+    // still come in, nothing else does.
+    void stopped();
+    void progress( quint32 fileId, qint64 done, qint64 total );
+
+private slots:
+    void onThreadFinished();
+    void doListFiles( int generation );
+    void doReadFile( int generation, quint32 fileId );
+    void doReadFileIfChanged( int generation, quint32 fileId, QByteArray known );
+    void doWriteFile( int generation, QByteArray data, quint32 fileId );
+    void doDeleteFile( int generation, quint32 fileId );
+    void doDownload( int generation, QString basePath, bool deleteWhenDone );
+    void doPostGPSFix( int generation );
+};
+
+#endif // WATCHWORKER_H
@@ -0,0 +1,204 @@
+#include "workoutaggregates.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDebug>
+
+#define AGGREGATES_MAGIC 0x54544147 // "TTAG"
+#define AGGREGATES_VERSION 1
+
+WorkoutAggregates::WorkoutAggregates() :
+    m_Dirty(false)
+{
+}
+
+qint32 WorkoutAggregates::bucket(Period period, const QDate &date)
+{
+    switch ( period )
+    {
+    case WEEK:
+    {
+        int year;
+        int week = date.weekNumber(&year); // ISO 8601 weeks, the year may differ around new year.
+        return year * 100 + week;
+    }
+    case MONTH:
+        return date.year() * 100 + date.month();
+    case YEAR:
+        return date.year();
+    }
+    return 0;
+}
+
+QDate WorkoutAggregates::periodStart(Period period, const QDate &date)
+{
+    switch ( period )
+    {
+    case WEEK:
+        return date.addDays(1 - date.dayOfWeek());
+    case MONTH:
+        return QDate(date.year(), date.month(), 1);
+    case YEAR:
+        return QDate(date.year(), 1, 1);
+    }
+    return date;
+}
+
+void WorkoutAggregates::update(const Workout &workout, int sign)
+{
+    if ( !workout.date.isValid() )
+    {
+        return;
+    }
+
+    for ( int period = WEEK; period <= YEAR; period++ )
+    {
+        Key key;
+        key.period = period;
+        key.bucket = bucket((Period)period, workout.date);
+
+        // the bucket itself and the rollups over all sports and all watches.
+        for ( int rollup = 0; rollup < 4; rollup++ )
+        {
+            key.sport = ( rollup & 1 ) ? ALL_SPORTS : workout.sport;
+            key.watch = ( rollup & 2 ) ? QString() : workout.watch;
+
+            Totals & t = m_Buckets[key];
+            t.count += sign;
+            t.duration += sign * (qint64)workout.duration;
+            t.distance += sign * workout.distance;
+            t.calories += sign * workout.calories;
+
+            if ( t.count == 0 )
+            {
+                m_Buckets.remove(key);
+            }
+        }
+    }
+    m_Dirty = true;
+}
+
+void WorkoutAggregates::add(const Workout &workout)
+{
+    update(workout, 1);
+}
+
+void WorkoutAggregates::remove(const Workout &workout)
+{
+    update(workout, -1);
+}
+
+void WorkoutAggregates::clear()
+{
+    m_Buckets.clear();
+    m_Dirty = true;
+}
+
+WorkoutAggregates::Totals WorkoutAggregates::totals(Period period, const QDate &date, int sport, const QString &watch) const
+{
+    Key key;
+    key.period = period;
+    key.bucket = bucket(period, date);
+    key.sport = sport;
+    key.watch = watch;
+    return m_Buckets.value(key);
+}
+
+QMap<QDate, WorkoutAggregates::Totals> WorkoutAggregates::series(Period period, const QDate &from, const QDate &to, int sport, const QString &watch) const
+{
+    QMap<QDate, Totals> result;
+    for ( QDate date = periodStart(period, from); date <= to; )
+    {
+        result.insert(date, totals(period, date, sport, watch));
+
+        switch ( period )
+        {
+        case WEEK:
+            date = date.addDays(7);
+            break;
+        case MONTH:
+            date = date.addMonths(1);
+            break;
+        case YEAR:
+            date = date.addYears(1);
+            break;
+        }
+    }
+    return result;
+}
+
+bool WorkoutAggregates::load(const QString &filename)
+{
+    QFile f(filename);
+    if ( !f.open(QIODevice::ReadOnly) )
+    {
+        return false;
+    }
+
+    QDataStream ds(&f);
+    quint32 magic, count;
+    quint8 version;
+    ds >> magic >> version >> count;
+    if ( magic != AGGREGATES_MAGIC || version != AGGREGATES_VERSION )
+    {
+        qWarning() << "WorkoutAggregates::load / unknown format, ignoring " << filename;
+        return false;
+    }
+
+    QHash<Key, Totals> buckets;
+    buckets.reserve(count);
+    for ( quint32 i = 0; i < count && ds.status() == QDataStream::Ok; i++ )
+    {
+        Key key;
+        Totals t;
+        ds >> key.period >> key.bucket >> key.sport >> key.watch
+           >> t.count >> t.duration >> t.distance >> t.calories;
+        buckets.insert(key, t);
+    }
+
+    if ( ds.status() != QDataStream::Ok )
+    {
+        qWarning() << "WorkoutAggregates::load / truncated file, ignoring " << filename;
+        return false;
+    }
+
+    m_Buckets = buckets;
+    m_Dirty = false;
+    return true;
+}
+
+bool WorkoutAggregates::save(const QString &filename)
+{
+    if ( !m_Dirty )
+    {
+        return true;
+    }
+
+    QSaveFile f(filename);
+    if ( !f.open(QIODevice::WriteOnly) )
+    {
+        qWarning() << "WorkoutAggregates::save / could not write " << filename << f.errorString();
+        return false;
+    }
+
+    QDataStream ds(&f);
+    ds << quint32(AGGREGATES_MAGIC) << quint8(AGGREGATES_VERSION) << quint32(m_Buckets.count());
+    QHash<Key, Totals>::const_iterator it;
+    for ( it = m_Buckets.constBegin(); it != m_Buckets.constEnd(); ++it )
+    {
+        const Key & key = it.key();
+        const Totals & t = it.value();
+        ds << key.period << key.bucket << key.sport << key.watch
+           << t.count << t.duration << t.distance << t.calories;
+    }
+
+    if ( !f.commit() )
+    {
+        qWarning() << "WorkoutAggregates::save / could not commit " << filename << f.errorString();
+        return false;
+    }
+
+    m_Dirty = false;
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef WORKOUTAGGREGATES_H
+#define WORKOUTAGGREGATES_H
+
+#include <QString>
+#include <QDate>
+#include <QDateTime>
+#include <QHash>
+#include <QMap>
+
+// Training totals per week, month and year, split by sport and watch. Every
+// workout is counted in one bucket per period for its own sport and watch and
+// in the rollups over all sports and/or all watches, so adding or removing a
+// workout touches a fixed number of buckets.
+class WorkoutAggregates
+{
+public:
+    enum Period { WEEK, MONTH, YEAR };
+    enum { ALL_SPORTS = -1 };
+
+    struct Totals
+    {
+        int count;
+        qint64 duration;  // seconds
+        double distance;  // meters
+        qint64 calories;
+
+        Totals() : count(0), duration(0), distance(0), calories(0) {}
+    };
+
+    struct Workout
+    {
+        QString watch;
+        QDate date;
+        int sport;
+        quint32 duration;
+        int distance;
+        int calories;
+    };
+
+    WorkoutAggregates();
+
+    void add( const Workout & workout );
+    void remove( const Workout & workout );
+    void clear();
+
+    // watch empty for all watches
+    Totals totals( Period period, const QDate & date, int sport = ALL_SPORTS, const QString & watch = QString() ) const;
+    QMap<QDate, Totals> series( Period period, const QDate & from, const QDate & to, int sport = ALL_SPORTS, const QString & watch = QString() ) const;
+
+    static QDate periodStart( Period period, const QDate & date );
+
+    bool load( const QString & filename );
+    bool save( const QString & filename );
+
+private:
+    struct Key
+    {
+        quint8 period;
+        qint32 bucket;
+        qint8 sport;
+        QString watch;
+
+        bool operator==( const Key & other ) const
+        {
+            return period == other.period && bucket == other.bucket && sport == other.sport && watch == other.watch;
+        }
+        friend inline uint qHash( const Key & key )
+        {
+            return qHash(key.watch) ^ uint(key.bucket * 31 + key.period * 7 + key.sport);
+        }
+    };
+
+    QHash<Key, Totals> m_Buckets;
+    bool m_Dirty;
+
+    static qint32 bucket( Period period, const QDate & date );
+    void update( const Workout & workout, int sign );
+};
+
+#endif // WORKOUTAGGREGATES_H
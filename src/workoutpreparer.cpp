@@ -0,0 +1,52 @@
+#include "workoutpreparer.h"
+
+#include <QMetaObject>
+#include <QDebug>
+#include "ttbinreader.h"
+#include "elevationloader.h"
+
+WorkoutPreparer::WorkoutPreparer(QObject *receiver, const QString &serial, const QString &filename, ActivityPtr activity, const QAtomicInt &cancel) :
+    m_Receiver(receiver),
+    m_Serial(serial),
+    m_Filename(filename),
+    m_Activity(activity),
+    m_Cancel(cancel)
+{
+}
+
+void WorkoutPreparer::run()
+{
+    int result = PREPARED;
+
+    if ( m_Cancel.load() )
+    {
+        result = CANCELLED;
+    }
+    else
+    {
+        if ( !m_Activity )
+        {
+            TTBinReader br;
+            m_Activity = br.read(m_Filename, true);
+        }
+
+        if ( !m_Activity )
+        {
+            qDebug() << "WorkoutPreparer::run / could not parse file " << m_Filename;
+            result = PARSE_FAILED;
+        }
+        else
+        {
+            // waits in a local event loop, the loader belongs to this thread.
+            ElevationLoader el;
+            if ( el.load(m_Activity, true) != ElevationLoader::SUCCESS )
+            {
+                result = ELEVATION_FAILED;
+            }
+        }
+    }
+
+    QMetaObject::invokeMethod(m_Receiver, "onWorkoutPrepared", Qt::QueuedConnection,
+                              Q_ARG(QString, m_Serial), Q_ARG(QString, m_Filename),
+                              Q_ARG(ActivityPtr, m_Activity), Q_ARG(int, result));
+}
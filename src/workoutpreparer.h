@@ -0,0 +1,30 @@
+#ifndef WORKOUTPREPARER_H
+#define WORKOUTPREPARER_H
+
+#include <QRunnable>
+#include <QObject>
+#include <QString>
+#include <QAtomicInt>
+#include "activity.h"
+
+// Gets a freshly downloaded workout ready for export on a worker thread:
+// parses the .ttbin when that did not happen during the download and loads the
+// elevation data. Hands the result to
+// receiver->onWorkoutPrepared(QString serial, QString filename, ActivityPtr, int result).
+class WorkoutPreparer : public QRunnable
+{
+    QObject * m_Receiver;
+    QString m_Serial;
+    QString m_Filename;
+    ActivityPtr m_Activity;
+    const QAtomicInt & m_Cancel;
+
+public:
+    enum Result { PREPARED, PARSE_FAILED, ELEVATION_FAILED, CANCELLED };
+
+    // activity may be null, the file is read then.
+    WorkoutPreparer( QObject * receiver, const QString & serial, const QString & filename, ActivityPtr activity, const QAtomicInt & cancel );
+    void run();
+};
+
+#endif // WORKOUTPREPARER_H
@@ -0,0 +1,134 @@
+#include "workoutscanner.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QMetaObject>
+#include <QTime>
+
+#include "ttbinreader.h"
+#include "trainingload.h"
+
+// number of directories handed to the model at once while walking.
+#define WALKER_BATCH_SIZE 32
+
+bool WorkoutDirListing::read(const QString &dirPath)
+{
+    path = dirPath;
+    files.clear();
+    dirs.clear();
+
+    QDir dir(dirPath);
+    if ( !dir.exists() )
+    {
+        return false;
+    }
+
+    foreach ( const QFileInfo & fi, dir.entryInfoList(QStringList() << "*.ttbin", QDir::Files) )
+    {
+        files.insert(fi.fileName(), qMakePair(fi.size(), fi.lastModified().toMSecsSinceEpoch()));
+    }
+    foreach ( const QString & name, dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot) )
+    {
+        dirs.insert(name);
+    }
+    return true;
+}
+
+bool WorkoutSummary::read(const QString &ttbinFilename)
+{
+    filename = ttbinFilename;
+
+    // a full read, the training load needs the heart rate samples. The result
+    // ends up in the library index so every file is only parsed once.
+    TTBinReader br;
+    ActivityPtr a = br.read(filename, true);
+    valid = !a.isNull();
+    if ( valid )
+    {
+        startTime = a->date();
+        duration = a->duration();
+        distance = a->distance();
+        sport = a->sport();
+        // the summary tag stores the workout total on the first lap.
+        calories = a->laps().isEmpty() ? 0 : qMax(0, a->laps().first()->calories());
+        trimp = TrainingLoad::trimp(a);
+    }
+    return valid;
+}
+
+WorkoutDirectoryWalker::WorkoutDirectoryWalker(QObject *receiver, const QString &root, int generation, const QAtomicInt &cancel) :
+    m_Receiver(receiver),
+    m_Root(root),
+    m_Generation(generation),
+    m_Cancel(cancel)
+{
+}
+
+void WorkoutDirectoryWalker::flush(WorkoutDirListings &batch, bool last)
+{
+    if ( m_Receiver )
+    {
+        QMetaObject::invokeMethod(m_Receiver, "onDirectoriesScanned", Qt::QueuedConnection,
+                                  Q_ARG(WorkoutDirListings, batch), Q_ARG(int, m_Generation), Q_ARG(bool, last));
+    }
+    batch.clear();
+}
+
+void WorkoutDirectoryWalker::run()
+{
+    WorkoutDirListings batch;
+    QStringList pending;
+    pending << m_Root;
+
+    while ( !pending.isEmpty() && !m_Cancel.load() )
+    {
+        WorkoutDirListing listing;
+        if ( !listing.read(pending.takeFirst()) )
+        {
+            continue;
+        }
+
+        foreach ( const QString & name, listing.dirs )
+        {
+            pending << listing.path + "/" + name;
+        }
+
+        batch.append(listing);
+        if ( batch.count() >= WALKER_BATCH_SIZE )
+        {
+            flush(batch, false);
+        }
+    }
+
+    flush(batch, true);
+}
+
+WorkoutSummaryReader::WorkoutSummaryReader(QObject *receiver, const QStringList &filenames, int generation, const QAtomicInt &cancel) :
+    m_Receiver(receiver),
+    m_Filenames(filenames),
+    m_Generation(generation),
+    m_Cancel(cancel)
+{
+}
+
+void WorkoutSummaryReader::run()
+{
+    WorkoutSummaries summaries;
+    foreach ( const QString & filename, m_Filenames )
+    {
+        if ( m_Cancel.load() )
+        {
+            break;
+        }
+
+        WorkoutSummary summary;
+        summary.read(filename);
+        summaries.append(summary);
+    }
+
+    if ( m_Receiver )
+    {
+        QMetaObject::invokeMethod(m_Receiver, "onSummariesRead", Qt::QueuedConnection,
+                                  Q_ARG(WorkoutSummaries, summaries), Q_ARG(int, m_Generation));
+    }
+}
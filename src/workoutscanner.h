@@ -0,0 +1,76 @@
+#ifndef WORKOUTSCANNER_H
+#define WORKOUTSCANNER_H
+
+#include <QRunnable>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QDateTime>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <QList>
+#include <QAtomicInt>
+#include "activity.h"
+
+// Contents of one library directory.
+struct WorkoutDirListing
+{
+    QString path;
+    QHash<QString, QPair<qint64, qint64> > files; // .ttbin name -> size, modification time
+    QSet<QString> dirs;
+
+    bool read( const QString & dirPath );
+};
+typedef QList<WorkoutDirListing> WorkoutDirListings;
+Q_DECLARE_METATYPE( WorkoutDirListings )
+
+// Summary of a workout as shown in the workout tree.
+struct WorkoutSummary
+{
+    QString filename;
+    QDateTime startTime;
+    quint32 duration;
+    int distance;
+    int calories;
+    float trimp;
+    Activity::Sport sport;
+    bool valid;
+
+    WorkoutSummary() : duration(0), distance(0), calories(0), trimp(0), sport(Activity::OTHER), valid(false) {}
+    bool read( const QString & ttbinFilename );
+};
+typedef QList<WorkoutSummary> WorkoutSummaries;
+Q_DECLARE_METATYPE( WorkoutSummaries )
+
+// Walks a directory tree on a worker thread and hands the listings to
+// receiver->onDirectoriesScanned(WorkoutDirListings,int,bool) in batches.
+class WorkoutDirectoryWalker : public QRunnable
+{
+    QObject * m_Receiver;
+    QString m_Root;
+    int m_Generation;
+    const QAtomicInt & m_Cancel;
+
+    void flush( WorkoutDirListings & batch, bool last );
+
+public:
+    WorkoutDirectoryWalker( QObject * receiver, const QString & root, int generation, const QAtomicInt & cancel );
+    void run();
+};
+
+// Reads the summaries of a number of workouts on a worker thread and hands them
+// to receiver->onSummariesRead(WorkoutSummaries,int).
+class WorkoutSummaryReader : public QRunnable
+{
+    QObject * m_Receiver;
+    QStringList m_Filenames;
+    int m_Generation;
+    const QAtomicInt & m_Cancel;
+
+public:
+    WorkoutSummaryReader( QObject * receiver, const QStringList & filenames, int generation, const QAtomicInt & cancel );
+    void run();
+};
+
+#endif // WORKOUTSCANNER_H
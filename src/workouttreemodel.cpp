@@ -1,15 +1,23 @@
 #include "workouttreemodel.h"
-#include <QDirIterator>
+#include <QDir>
+#include <QFileInfo>
 #include <QDebug>
 #include <QFile>
-#include <QDataStream>
+#include <string.h>
+#include <algorithm>
+#include <limits>
 
 #include "settings.h"
-#include "ttbinreader.h"
 
-TTWatchItem::TTWatchItem(const QString &name, QObject *parent) :
-    TTItem(parent),
-    m_Name(name)
+// number of workouts parsed per background task during a scan.
+#define SUMMARY_BATCH_SIZE 16
+// number of workout rows handed to the views per fetchMore.
+#define WORKOUT_PAGE_SIZE 256
+
+TTWatchItem::TTWatchItem(const QString &name) :
+    TTItem(0),
+    m_Name(name),
+    m_Fetched(0)
 {
 }
 
@@ -27,6 +35,21 @@ bool TTWatchItem::match(const QString &name)
     return m_Name == name;
 }
 
+QString TTWatchItem::name() const
+{
+    return m_Name;
+}
+
+int TTWatchItem::count() const
+{
+    return m_Workouts.count();
+}
+
+TTWorkoutItem *TTWatchItem::at(int row) const
+{
+    return m_Workouts.at(row);
+}
+
 
 QString TTWorkoutItem::formatDistance() const
 {
@@ -100,8 +123,15 @@ TTWorkoutItem::TTWorkoutItem(const QString &name, const QString &filename, TTWat
     m_Name(name),
     m_Filename(filename),
     m_Distance(0),
+    m_Calories(0),
+    m_Trimp(0),
+    m_Sport(Activity::OTHER),
     m_Tag(false)
 {
+    for ( int key = 0; key < SORT_KEY_COUNT; key++ )
+    {
+        m_SortKeys[key] = 0;
+    }
 }
 
 QVariant TTWorkoutItem::data(int column, int role) const
@@ -164,45 +194,57 @@ void TTWorkoutItem::set(QDateTime startTime, QTime duration, int distance, Activ
     m_Duration = duration;
     m_Distance = distance;
     m_Sport = sport;
+
+    // precomputed so sorting and filtering never go through data() and QVariant.
+    int seconds = QTime(0,0,0).secsTo(m_Duration);
+    m_SortKeys[SORT_DATE] = dateKey(m_StartTime);
+    m_SortKeys[SORT_DURATION] = seconds;
+    m_SortKeys[SORT_DISTANCE] = m_Distance;
+    m_SortKeys[SORT_PACE] = m_Distance == 0 ? 0 : seconds / 60.0 / m_Distance * 1000.0; // ( minutes per K )
+    m_SortKeys[SORT_SPORT] = (int)m_Sport;
 }
 
-bool TTWorkoutItem::saveCache()
+void TTWorkoutItem::set(const WorkoutSummary &summary)
 {
-    QFile f( m_Filename + ".cache");
-    if ( !f.open(QIODevice::WriteOnly))
-    {
-        return false;
-    }
-    QDataStream ds(&f);
-    ds << quint8(1) << m_StartTime << m_Duration << m_Distance << (quint8)m_Sport;
-    return true;
+    set(summary.startTime, QTime(0,0,0).addSecs(summary.duration), summary.distance, summary.sport);
+    m_Calories = summary.calories;
+    m_Trimp = summary.trimp;
 }
 
-bool TTWorkoutItem::loadCache()
+bool TTWorkoutItem::loadIndex(LibraryIndex &index)
 {
-    quint8 version, sport;
-
-    QFile f( m_Filename + ".cache");
-    if ( !f.open(QIODevice::ReadOnly))
+    LibraryIndexRecord record;
+    if ( !index.lookup(m_Filename, record) || record.sport > (quint8)Activity::OTHER )
     {
         return false;
     }
-    QDataStream ds(&f);
-
-    ds >> version;
-
-    switch ( version )
-    {
-    case 1:
-        ds >> m_StartTime >> m_Duration >> m_Distance >> sport;
-        break;
-    }
 
-    m_Sport = (Activity::Sport)sport;
+    // the start time is wall clock time tagged as local time, see TTBinReader::readTime.
+    QDateTime startTime = QDateTime::fromMSecsSinceEpoch(record.startTime, Qt::UTC);
+    startTime.setTimeSpec(Qt::LocalTime);
 
+    set(startTime, QTime(0,0,0).addSecs(record.duration), record.distance, (Activity::Sport)record.sport);
+    m_Calories = (int)record.metrics[LibraryIndexRecord::METRIC_CALORIES];
+    m_Trimp = record.metrics[LibraryIndexRecord::METRIC_TRIMP];
     return true;
 }
 
+void TTWorkoutItem::saveIndex(LibraryIndex &index) const
+{
+    LibraryIndexRecord record;
+    memset(&record, 0, sizeof(record));
+    record.startTime = QDateTime(m_StartTime.date(), m_StartTime.time(), Qt::UTC).toMSecsSinceEpoch();
+    record.duration = QTime(0,0,0).secsTo(m_Duration);
+    record.distance = m_Distance;
+    record.sport = (quint8)m_Sport;
+    record.metrics[LibraryIndexRecord::METRIC_CALORIES] = m_Calories;
+    record.metrics[LibraryIndexRecord::METRIC_TRIMP] = m_Trimp;
+    index.insert(m_Filename, record);
+
+    // the library index replaces the .cache sidecar files of older versions.
+    QFile::remove(m_Filename + ".cache");
+}
+
 QString TTWorkoutItem::filename() const
 {
     return m_Filename;
@@ -223,13 +265,112 @@ Activity::Sport TTWorkoutItem::sport() const
     return m_Sport;
 }
 
+QDateTime TTWorkoutItem::startTime() const
+{
+    return m_StartTime;
+}
 
-TTWatchItem *WorkoutTreeModel::getWatchItem(const QString &name, bool * newlyCreated )
+int TTWorkoutItem::distance() const
 {
-    if ( newlyCreated )
+    return m_Distance;
+}
+
+int TTWorkoutItem::calories() const
+{
+    return m_Calories;
+}
+
+void TTWorkoutItem::setCalories(int calories)
+{
+    m_Calories = calories;
+}
+
+float TTWorkoutItem::trimp() const
+{
+    return m_Trimp;
+}
+
+QTime TTWorkoutItem::duration() const
+{
+    return m_Duration;
+}
+
+double TTWorkoutItem::dateKey(const QDateTime &dateTime)
+{
+    // start times are wall clock times, compare them without time zone conversions.
+    return QDateTime(dateTime.date(), dateTime.time(), Qt::UTC).toMSecsSinceEpoch();
+}
+
+bool WorkoutFilter::isEmpty() const
+{
+    return !from.isValid() && !to.isValid() && sports.isEmpty() && minDistance < 0 && maxDistance < 0;
+}
+
+bool WorkoutFilter::matches(const TTWorkoutItem *item) const
+{
+    double date = item->sortKey(TTWorkoutItem::SORT_DATE);
+    if ( from.isValid() && date < TTWorkoutItem::dateKey(from) )
     {
-        *newlyCreated = false;
+        return false;
+    }
+    if ( to.isValid() && date > TTWorkoutItem::dateKey(to) )
+    {
+        return false;
+    }
+    if ( !sports.isEmpty() && !sports.contains((int)item->sport()) )
+    {
+        return false;
     }
+    if ( minDistance >= 0 && item->distance() < minDistance )
+    {
+        return false;
+    }
+    if ( maxDistance >= 0 && item->distance() > maxDistance )
+    {
+        return false;
+    }
+    return true;
+}
+
+namespace
+{
+    // orders workouts on one sort key, ties are broken on the item so every
+    // workout has a unique position in an index.
+    struct SortKeyLess
+    {
+        int key;
+        explicit SortKeyLess( int k ) : key(k) {}
+        bool operator()( const TTWorkoutItem * a, const TTWorkoutItem * b ) const
+        {
+            double ka = a->sortKey(key), kb = b->sortKey(key);
+            return ka < kb || ( ka == kb && a < b );
+        }
+    };
+
+    struct DisplayLess
+    {
+        SortKeyLess less;
+        bool descending;
+        DisplayLess( int key, Qt::SortOrder order ) : less(key), descending(order == Qt::DescendingOrder) {}
+        bool operator()( const TTWorkoutItem * a, const TTWorkoutItem * b ) const
+        {
+            return descending ? less(b, a) : less(a, b);
+        }
+    };
+
+    // compares a sort key against a bound, for binary searching a value range.
+    struct SortKeyBound
+    {
+        int key;
+        explicit SortKeyBound( int k ) : key(k) {}
+        bool operator()( const TTWorkoutItem * a, double value ) const { return a->sortKey(key) < value; }
+        bool operator()( double value, const TTWorkoutItem * a ) const { return value < a->sortKey(key); }
+    };
+}
+
+
+TTWatchItem *WorkoutTreeModel::getWatchItem(const QString &name)
+{
     foreach ( TTWatchItem * item, m_WatchItems)
     {
         if ( item->match(name) )
@@ -238,201 +379,667 @@ TTWatchItem *WorkoutTreeModel::getWatchItem(const QString &name, bool * newlyCre
         }
     }
 
-    if ( newlyCreated )
-    {
-        *newlyCreated = true;
-    }
-    TTWatchItem * item = new TTWatchItem(name, 0);
+    int row = m_WatchItems.count();
+    beginInsertRows(QModelIndex(), row, row);
+    TTWatchItem * item = new TTWatchItem(name);
+    item->m_Row = row;
     m_WatchItems.append(item);
+    endInsertRows();
     return item;
 }
 
 TTWorkoutItem * WorkoutTreeModel::getWorkoutItem(const QString &filename) const
 {
-    foreach ( TTWatchItem * watchItem, m_WatchItems )
+    return m_WorkoutIndex.value(filename, 0);
+}
+
+void WorkoutTreeModel::clearTags()
+{
+    foreach (TTWorkoutItem * item, m_WorkoutIndex)
+    {
+        item->setTag(false);
+    }
+}
+
+void WorkoutTreeModel::deleteUntagged()
+{
+    QList<TTWorkoutItem*> untagged;
+    foreach (TTWorkoutItem * item, m_WorkoutIndex)
     {
-        QList<TTWorkoutItem*> items = watchItem->findChildren<TTWorkoutItem*>();
-        foreach ( TTWorkoutItem * item, items )
+        if ( !item->tag() )
         {
-            if ( item->match( filename ) )
-            {
-                return item;
-            }
+            untagged.append(item);
         }
     }
-    return 0;
+
+    foreach (TTWorkoutItem * item, untagged)
+    {
+        removeWorkout(item);
+    }
 }
 
-void WorkoutTreeModel::clearTags()
+void WorkoutTreeModel::removeWorkout(const QString &filename)
+{
+    TTWorkoutItem * item = getWorkoutItem(filename);
+    if ( item )
+    {
+        removeWorkout(item);
+    }
+}
+
+void WorkoutTreeModel::removeWorkout(TTWorkoutItem *item)
 {
-    foreach( TTWatchItem * watchItem, m_WatchItems)
+    hideWorkout(item);
+    unindexWorkout(item);
+    aggregate(item, false);
+    m_WorkoutIndex.remove(item->filename());
+    m_LibraryIndex.remove(item->filename());
+    delete item;
+}
+
+bool WorkoutTreeModel::splitFilename(const QString &filename, QString &watchName, QString &name) const
+{
+    if ( filename.length() < m_TTDir.length() )
     {
-        foreach (TTWorkoutItem * item, watchItem->findChildren<TTWorkoutItem*>())
+        qDebug() << "WorkoutTreeModel::splitFilename / filename not long enough " << filename;
+        return false;
+    }
+
+    QString n = filename.mid( m_TTDir.length());
+    QStringList nparts = n.split("/", QString::SkipEmptyParts);
+    if ( nparts.count() < 1 )
+    {
+        qDebug() << "WorkoutTreeModel::splitFilename / filename split didnt return enough parts " << filename;
+        return false;
+    }
+
+    watchName = nparts.first();
+    name = nparts.last();
+    return true;
+}
+
+TTWorkoutItem *WorkoutTreeModel::createWorkout(const QString &filename) const
+{
+    QString watchName, name;
+    if ( !splitFilename(filename, watchName, name) )
+    {
+        return 0;
+    }
+
+    TTWorkoutItem * item = new TTWorkoutItem( name, filename );
+    item->setTag(true);
+    return item;
+}
+
+void WorkoutTreeModel::insertWorkout(TTWorkoutItem *item)
+{
+    QString watchName, name;
+    splitFilename(item->filename(), watchName, name);
+    item->m_Parent = getWatchItem(watchName);
+    item->m_Row = -1;
+
+    m_WorkoutIndex.insert(item->filename(), item);
+    indexWorkout(item);
+    aggregate(item, true);
+    showWorkout(item);
+}
+
+void WorkoutTreeModel::aggregate(const TTWorkoutItem *item, bool add)
+{
+    WorkoutAggregates::Workout workout;
+    workout.watch = static_cast<TTWatchItem*>(item->parent())->name();
+    workout.date = item->startTime().date();
+    workout.sport = (int)item->sport();
+    workout.duration = QTime(0,0,0).secsTo(item->duration());
+    workout.distance = item->distance();
+    workout.calories = item->calories();
+
+    WorkoutAggregates & aggregates = isScanning() ? m_ScanAggregates : m_Aggregates;
+    TrainingLoad & trainingLoad = isScanning() ? m_ScanTrainingLoad : m_TrainingLoad;
+    if ( add )
+    {
+        aggregates.add(workout);
+        trainingLoad.add(workout.date, item->trimp());
+    }
+    else
+    {
+        aggregates.remove(workout);
+        trainingLoad.remove(workout.date, item->trimp());
+    }
+
+    if ( !isScanning() )
+    {
+        emit aggregatesChanged();
+    }
+}
+
+QString WorkoutTreeModel::aggregatesFilename() const
+{
+    return QDir(m_TTDir).filePath("library.aggregates");
+}
+
+const WorkoutAggregates &WorkoutTreeModel::aggregates() const
+{
+    return m_Aggregates;
+}
+
+const TrainingLoad &WorkoutTreeModel::trainingLoad() const
+{
+    return m_TrainingLoad;
+}
+
+void WorkoutTreeModel::indexWorkout(TTWorkoutItem *item)
+{
+    for ( int key = 0; key < TTWorkoutItem::SORT_KEY_COUNT; key++ )
+    {
+        QVector<TTWorkoutItem*> & index = m_SortIndexes[key];
+        if ( isScanning() || !m_SortIndexesValid )
         {
-            item->setTag(false);
+            // sorted once when the scan is done, see ensureSortIndexes.
+            index.append(item);
+            m_SortIndexesValid = false;
+        }
+        else
+        {
+            index.insert(std::upper_bound(index.begin(), index.end(), item, SortKeyLess(key)), item);
         }
     }
 }
 
-void WorkoutTreeModel::deleteUntagged()
+void WorkoutTreeModel::unindexWorkout(TTWorkoutItem *item)
 {
-    foreach( TTWatchItem * watchItem, m_WatchItems)
+    for ( int key = 0; key < TTWorkoutItem::SORT_KEY_COUNT; key++ )
     {
-        foreach (TTWorkoutItem * item, watchItem->findChildren<TTWorkoutItem*>())
+        QVector<TTWorkoutItem*> & index = m_SortIndexes[key];
+        if ( m_SortIndexesValid )
         {
-            if (!item->tag())
+            QVector<TTWorkoutItem*>::iterator it = std::lower_bound(index.begin(), index.end(), item, SortKeyLess(key));
+            if ( it != index.end() && *it == item )
             {
-                TTWatchItem * watchItem = (TTWatchItem*)item->parent();
-                int row = watchItem->children().indexOf( item );
-                beginRemoveRows(findWatchItem( watchItem), row, row );
-                item->deleteLater();
-                endRemoveRows();
+                index.erase(it);
             }
         }
+        else
+        {
+            index.removeOne(item);
+        }
     }
 }
 
-
-void WorkoutTreeModel::process(const QString &filename, bool full)
+void WorkoutTreeModel::ensureSortIndexes() const
 {
-    if ( filename.length() < m_TTDir.length() )
+    if ( m_SortIndexesValid )
     {
-        qDebug() << "WorkoutTreeModel::process / filename not long enough " << filename;
         return;
     }
 
-    QString n = filename.mid( m_TTDir.length());
-    QStringList nparts = n.split("/", QString::SkipEmptyParts);
-    if ( nparts.count() < 1 )
+    for ( int key = 0; key < TTWorkoutItem::SORT_KEY_COUNT; key++ )
     {
-        qDebug() << "WorkoutTreeModel::process / filename split didnt return enough parts " << filename;
+        std::sort(m_SortIndexes[key].begin(), m_SortIndexes[key].end(), SortKeyLess(key));
+    }
+    m_SortIndexesValid = true;
+}
+
+void WorkoutTreeModel::renumber(TTWatchItem *watchItem, int from)
+{
+    for ( int i = from; i < watchItem->m_Workouts.count(); i++ )
+    {
+        watchItem->m_Workouts.at(i)->m_Row = i;
+    }
+}
+
+void WorkoutTreeModel::showWorkout(TTWorkoutItem *item)
+{
+    if ( !m_Filter.matches(item) )
+    {
+        item->m_Row = -1;
         return;
     }
 
-    QString watchName = nparts[0];
-    bool newlyCreated;
-    TTWatchItem * watchItem = getWatchItem(watchName, &newlyCreated);
-    if ( watchItem == 0 )
+    TTWatchItem * watchItem = static_cast<TTWatchItem*>(item->parent());
+    QVector<TTWorkoutItem*> & rows = watchItem->m_Workouts;
+
+    int row = rows.count();
+    if ( m_DisplaySorted )
+    {
+        row = std::upper_bound(rows.begin(), rows.end(), item, DisplayLess(m_SortColumn, m_SortOrder)) - rows.begin();
+    }
+
+    // rows beyond the fetched ones are left for fetchMore, apart from the first
+    // page and additions after the library has been scanned.
+    bool visible = row < watchItem->m_Fetched ||
+            ( row == watchItem->m_Fetched && row == rows.count() && ( row < WORKOUT_PAGE_SIZE || !isScanning() ) );
+
+    if ( visible )
+    {
+        beginInsertRows(findWatchItem(watchItem), row, row);
+    }
+    rows.insert(row, item);
+    renumber(watchItem, row);
+    if ( visible )
+    {
+        watchItem->m_Fetched++;
+        endInsertRows();
+    }
+}
+
+void WorkoutTreeModel::hideWorkout(TTWorkoutItem *item)
+{
+    int row = item->row();
+    if ( row < 0 )
     {
-        qDebug() << "WorkoutTreeModel::process / getWatchItem return 0 " << filename;
         return;
     }
 
-    if ( newlyCreated )
+    TTWatchItem * watchItem = static_cast<TTWatchItem*>(item->parent());
+    bool visible = row < watchItem->m_Fetched;
+    if ( visible )
+    {
+        beginRemoveRows(findWatchItem(watchItem), row, row);
+    }
+    watchItem->m_Workouts.remove(row);
+    renumber(watchItem, row);
+    item->m_Row = -1;
+    if ( visible )
+    {
+        watchItem->m_Fetched--;
+        endRemoveRows();
+    }
+}
+
+void WorkoutTreeModel::layoutRows()
+{
+    foreach ( TTWatchItem * watchItem, m_WatchItems )
+    {
+        watchItem->m_Workouts.clear();
+    }
+    foreach ( TTWorkoutItem * item, m_WorkoutIndex )
+    {
+        item->m_Row = -1;
+    }
+
+    foreach ( TTWorkoutItem * item, query(m_Filter, m_SortColumn, m_SortOrder) )
     {
-        m_FileSystemWatcher.addPath( m_TTDir + QDir::separator() + watchName );
+        TTWatchItem * watchItem = static_cast<TTWatchItem*>(item->parent());
+        item->m_Row = watchItem->m_Workouts.count();
+        watchItem->m_Workouts.append(item);
     }
+    m_DisplaySorted = true;
+}
+
+void WorkoutTreeModel::sortDisplay()
+{
+    // the filter did not change so every watch keeps its row count, only the
+    // order changes.
+    emit layoutAboutToBeChanged();
 
-    if ( !full )
+    layoutRows();
+
+    QModelIndexList from = persistentIndexList();
+    QModelIndexList to;
+    foreach ( const QModelIndex & index, from )
     {
-        TTWorkoutItem * wi = getWorkoutItem(filename);
-        if ( wi )
+        TTItem * item = (TTItem *)index.internalPointer();
+        if ( item->type() == TTItem::WatchItem )
         {
-            // already existing, bail out!
-            wi->setTag(true);
-            return;
+            to.append(index);
+        }
+        else if ( item->row() >= 0 && item->row() < static_cast<TTWatchItem*>(item->parent())->m_Fetched )
+        {
+            to.append(createIndex(item->row(), index.column(), item));
+        }
+        else
+        {
+            to.append(QModelIndex());
         }
     }
+    changePersistentIndexList(from, to);
 
-    TTWorkoutItem * item = new TTWorkoutItem( nparts.last(), filename, 0 );
-    item->setTag(true);
-    if ( !item->loadCache() )
+    emit layoutChanged();
+}
+
+void WorkoutTreeModel::sort(int column, Qt::SortOrder order)
+{
+    if ( column < 0 || column >= TTWorkoutItem::SORT_KEY_COUNT )
     {
-        TTBinReader br;
-        ActivityPtr a = br.read(filename, true, true);
-        if ( a )
-        {
+        return;
+    }
+    if ( column == m_SortColumn && order == m_SortOrder && m_DisplaySorted )
+    {
+        return;
+    }
+
+    m_SortColumn = column;
+    m_SortOrder = order;
+
+    // while scanning the rows are sorted once the scan is done.
+    if ( !isScanning() )
+    {
+        ensureSortIndexes();
+        sortDisplay();
+    }
+}
+
+void WorkoutTreeModel::setFilter(const WorkoutFilter &filter)
+{
+    beginResetModel();
+    m_Filter = filter;
+    layoutRows();
+    foreach ( TTWatchItem * watchItem, m_WatchItems )
+    {
+        watchItem->m_Fetched = qMin(watchItem->count(), WORKOUT_PAGE_SIZE);
+    }
+    endResetModel();
+}
+
+WorkoutFilter WorkoutTreeModel::filter() const
+{
+    return m_Filter;
+}
+
+QVector<TTWorkoutItem*> WorkoutTreeModel::query(const WorkoutFilter &filter, int sortKey, Qt::SortOrder order) const
+{
+    ensureSortIndexes();
+
+    // a date or distance range is answered with a binary search on its index,
+    // the other conditions are only checked on the workouts inside the range.
+    int rangeKey = -1;
+    double lower = 0, upper = 0;
+    if ( filter.from.isValid() || filter.to.isValid() )
+    {
+        rangeKey = TTWorkoutItem::SORT_DATE;
+        lower = filter.from.isValid() ? TTWorkoutItem::dateKey(filter.from) : -std::numeric_limits<double>::max();
+        upper = filter.to.isValid() ? TTWorkoutItem::dateKey(filter.to) : std::numeric_limits<double>::max();
+    }
+    else if ( filter.minDistance >= 0 || filter.maxDistance >= 0 )
+    {
+        rangeKey = TTWorkoutItem::SORT_DISTANCE;
+        lower = filter.minDistance >= 0 ? filter.minDistance : -std::numeric_limits<double>::max();
+        upper = filter.maxDistance >= 0 ? filter.maxDistance : std::numeric_limits<double>::max();
+    }
+
+    int indexKey = rangeKey >= 0 ? rangeKey : sortKey;
+    const QVector<TTWorkoutItem*> & index = m_SortIndexes[indexKey];
+    QVector<TTWorkoutItem*>::const_iterator first = index.constBegin();
+    QVector<TTWorkoutItem*>::const_iterator last = index.constEnd();
+    if ( rangeKey >= 0 )
+    {
+        first = std::lower_bound(index.constBegin(), index.constEnd(), lower, SortKeyBound(rangeKey));
+        last = std::upper_bound(first, index.constEnd(), upper, SortKeyBound(rangeKey));
+    }
 
-            QTime t(0,0,0);
-            t = t.addSecs(a->duration());
-            item->set(a->date(), t, a->distance(),a->sport());
-            item->saveCache();
+    QVector<TTWorkoutItem*> result;
+    result.reserve(last - first);
+    for ( QVector<TTWorkoutItem*>::const_iterator it = first; it != last; ++it )
+    {
+        if ( filter.matches(*it) )
+        {
+            result.append(*it);
         }
-        else
+    }
+
+    if ( indexKey != sortKey )
+    {
+        std::sort(result.begin(), result.end(), DisplayLess(sortKey, order));
+    }
+    else if ( order == Qt::DescendingOrder )
+    {
+        std::reverse(result.begin(), result.end());
+    }
+    return result;
+}
+
+void WorkoutTreeModel::process(const QString &filename)
+{
+    TTWorkoutItem * wi = getWorkoutItem(filename);
+    if ( wi )
+    {
+        // already existing, only reload it when the file changed.
+        wi->setTag(true);
+        LibraryIndexRecord record;
+        if ( !m_LibraryIndex.lookup(filename, record) )
         {
-            item->deleteLater();
-            item = 0;
+            reloadWorkout(wi);
         }
+        return;
     }
 
+    TTWorkoutItem * item = createWorkout(filename);
     if ( item == 0 )
     {
         return;
     }
 
-    if ( !full )
+    if ( !item->loadIndex(m_LibraryIndex) )
     {
-        if ( newlyCreated )
+        WorkoutSummary summary;
+        if ( !summary.read(filename) )
         {
-            beginInsertRows(QModelIndex(),m_WatchItems.count(),m_WatchItems.count());
+            delete item;
+            return;
         }
-        else
+        item->set(summary);
+        item->saveIndex(m_LibraryIndex);
+    }
+
+    insertWorkout(item);
+}
+
+void WorkoutTreeModel::rescanDirectory(const QString &path)
+{
+    WorkoutDirListing previous = m_Listings.take(path);
+    WorkoutDirListing current;
+
+    if ( current.read(path) )
+    {
+        m_Listings.insert(path, current);
+        watchDirectory(path);
+    }
+
+    foreach ( const QString & name, previous.dirs )
+    {
+        if ( !current.dirs.contains(name) )
+        {
+            forgetDirectory(path + "/" + name);
+        }
+    }
+
+    QHash<QString, QPair<qint64, qint64> >::const_iterator it;
+    for ( it = previous.files.constBegin(); it != previous.files.constEnd(); ++it )
+    {
+        if ( !current.files.contains(it.key()) )
         {
-            QModelIndex parent = findWatchItem(watchItem);
-            int count = watchItem->children().count();
-            beginInsertRows(parent, count, count);
+            removeWorkout(path + "/" + it.key());
         }
     }
 
+    for ( it = current.files.constBegin(); it != current.files.constEnd(); ++it )
+    {
+        QHash<QString, QPair<qint64, qint64> >::const_iterator known = previous.files.constFind(it.key());
+        if ( known == previous.files.constEnd() || known.value() != it.value() )
+        {
+            process(path + "/" + it.key());
+        }
+    }
 
-    item->setParent(watchItem);
+    foreach ( const QString & name, current.dirs )
+    {
+        if ( !previous.dirs.contains(name) )
+        {
+            rescanDirectory(path + "/" + name);
+        }
+    }
+}
 
+void WorkoutTreeModel::forgetDirectory(const QString &path)
+{
+    WorkoutDirListing listing = m_Listings.take(path);
 
-    if ( !full )
+    foreach ( const QString & name, listing.files.keys() )
     {
-        endInsertRows();
+        removeWorkout(path + "/" + name);
+    }
+    foreach ( const QString & name, listing.dirs )
+    {
+        forgetDirectory(path + "/" + name);
+    }
+
+    if ( m_WatchedDirs.remove(path) )
+    {
+        m_FileSystemWatcher.removePath(path);
     }
+    m_ChangedDirs.remove(path);
 }
 
-void WorkoutTreeModel::rescan(bool full)
+void WorkoutTreeModel::watchDirectory(const QString &path)
 {
+    if ( !m_WatchedDirs.contains(path) )
+    {
+        m_WatchedDirs.insert(path);
+        m_FileSystemWatcher.addPath(path);
+    }
+}
 
+void WorkoutTreeModel::rescan(bool full)
+{
     if ( full )
     {
-        beginResetModel();
-        clear();
+        startScan();
+        return;
     }
-    else
+
+    clearTags();
+
+    // start from empty listings so every file is checked, existing workouts are
+    // only reloaded when their library index entry went stale.
+    m_Listings.clear();
+    m_ChangedDirs.clear();
+    rescanDirectory(m_TTDir);
+
+    deleteUntagged();
+
+    saveIndex();
+}
+
+void WorkoutTreeModel::refresh(const QStringList &filenames)
+{
+    QSet<QString> dirs;
+    foreach ( const QString & filename, filenames )
     {
-        clearTags();
+        // rescan the deepest directory we already know, it picks up any new subdirectories.
+        QString dir = QFileInfo(QDir::cleanPath(filename)).path();
+        while ( !m_Listings.contains(dir) && dir.length() > m_TTDir.length() )
+        {
+            dir = QFileInfo(dir).path();
+        }
+        if ( dir.startsWith(m_TTDir) )
+        {
+            dirs.insert(dir);
+        }
     }
 
-    QDirIterator it(m_TTDir, QStringList() << "*.ttbin", QDir::Files, QDirIterator::Subdirectories);
-    while (it.hasNext())
+    foreach ( const QString & dir, dirs )
     {
-        process(it.next(), full);
+        m_ChangedDirs.remove(dir);
+        rescanDirectory(dir);
     }
 
-    if ( full )
+    saveIndex();
+}
+
+void WorkoutTreeModel::startScan()
+{
+    beginResetModel();
+    clear();
+    m_Listings.clear();
+    m_ChangedDirs.clear();
+    m_DisplaySorted = false;
+    m_ScanAggregates.clear();
+    m_ScanTrainingLoad.clear();
+    endResetModel();
+
+    // results of an earlier scan that are still underway are dropped on arrival.
+    m_ScanGeneration++;
+    m_ScanTasks = 1;
+    m_ScanPool.start(new WorkoutDirectoryWalker(this, m_TTDir, m_ScanGeneration, m_CancelScan));
+}
+
+bool WorkoutTreeModel::isScanning() const
+{
+    return m_ScanTasks > 0;
+}
+
+void WorkoutTreeModel::saveIndex()
+{
+    // the index drops entries that were not seen, so it may only be written
+    // once a scan has visited the whole library.
+    if ( !isScanning() )
     {
-        endResetModel();
+        m_LibraryIndex.save();
+        m_Aggregates.save(aggregatesFilename());
     }
-    else
+}
+
+void WorkoutTreeModel::scanTaskDone()
+{
+    m_ScanTasks--;
+    if ( m_ScanTasks == 0 )
     {
-        deleteUntagged();
+        m_Aggregates = m_ScanAggregates;
+        m_ScanAggregates.clear();
+        m_TrainingLoad = m_ScanTrainingLoad;
+        m_ScanTrainingLoad.clear();
+        emit aggregatesChanged();
+
+        saveIndex();
+        ensureSortIndexes();
+        sortDisplay();
+        emit scanFinished();
     }
 }
 
 WorkoutTreeModel::WorkoutTreeModel(const QString & ttDir, QObject *parent) :
     QAbstractItemModel(parent),
-    m_TTDir(ttDir)
+    m_TTDir(QDir::cleanPath(ttDir)),
+    m_LibraryIndex(QDir(ttDir).filePath("library.index")),
+    m_ScanGeneration(0),
+    m_ScanTasks(0),
+    m_SortIndexesValid(true),
+    m_SortColumn(TTWorkoutItem::SORT_DATE),
+    m_SortOrder(Qt::DescendingOrder),
+    m_DisplaySorted(false)
 {
-    connect(&m_FileSystemWatcher, SIGNAL(directoryChanged(QString)), this, SLOT(fileSystemChanged()));
-    rescan(true);
+    qRegisterMetaType<WorkoutDirListings>("WorkoutDirListings");
+    qRegisterMetaType<WorkoutSummaries>("WorkoutSummaries");
+
+    // coalesce the bursts of change notifications a download causes.
+    m_RescanTimer.setSingleShot(true);
+    m_RescanTimer.setInterval(500);
+    connect(&m_RescanTimer, SIGNAL(timeout()), this, SLOT(rescanChangedDirectories()));
+    connect(&m_FileSystemWatcher, SIGNAL(directoryChanged(QString)), this, SLOT(fileSystemChanged(QString)));
+    m_LibraryIndex.open();
+    m_Aggregates.load(aggregatesFilename());
+    startScan();
 }
 
 WorkoutTreeModel::~WorkoutTreeModel()
 {
+    m_CancelScan.store(1);
+    m_ScanPool.waitForDone();
     clear();
 }
 
 void WorkoutTreeModel::clear()
 {
-    foreach ( TTWatchItem * item, m_WatchItems)
+    qDeleteAll(m_WorkoutIndex);
+    m_WorkoutIndex.clear();
+    qDeleteAll(m_WatchItems);
+    m_WatchItems.clear();
+    for ( int key = 0; key < TTWorkoutItem::SORT_KEY_COUNT; key++ )
     {
-        item->deleteLater();
+        m_SortIndexes[key].clear();
     }
-    m_WatchItems.clear();
+    m_SortIndexesValid = true;
 }
 
 
@@ -441,16 +1048,20 @@ QModelIndex WorkoutTreeModel::index(int row, int column, const QModelIndex &pare
     if ( parent.isValid() )
     {
         TTItem * item = (TTItem *)parent.internalPointer();
-        QObjectList children = item->children();
-        if ( row >= children.count( ))
+        if ( item->type() != TTItem::WatchItem )
+        {
+            return QModelIndex();
+        }
+        TTWatchItem * watchItem = static_cast<TTWatchItem*>(item);
+        if ( row < 0 || row >= watchItem->m_Fetched )
         {
             return QModelIndex();
         }
-        return createIndex(row, column, children.at(row));
+        return createIndex(row, column, watchItem->at(row));
     }
     else
     {
-        if ( row >= m_WatchItems.count() )
+        if ( row < 0 || row >= m_WatchItems.count() )
         {
             return QModelIndex();
         }
@@ -471,29 +1082,13 @@ QModelIndex WorkoutTreeModel::parent(const QModelIndex &child) const
         return QModelIndex();
     }
 
-    TTItem * parentItem = (TTItem*)childItem->parent();
+    TTItem * parentItem = childItem->parent();
     if ( !parentItem )
     {
         return QModelIndex();
     }
 
-    if ( (QObject*)parentItem == this )
-    {
-        return QModelIndex();
-    }
-
-    int row = 0;
-
-    if ( parentItem->parent() == this )
-    {
-        row = m_WatchItems.indexOf( (TTWatchItem*)parentItem );
-    }
-    else
-    {
-        row = parentItem->children().indexOf(parentItem);
-    }
-
-    return createIndex(row, 0, parentItem);
+    return createIndex(parentItem->row(), 0, parentItem);
 
 }
 
@@ -506,14 +1101,57 @@ int WorkoutTreeModel::rowCount(const QModelIndex &parent) const
     else
     {
         TTItem * item = (TTItem *)parent.internalPointer();
-        if ( item )
+        if ( item && item->type() == TTItem::WatchItem )
         {
-            return item->children().count();
+            return static_cast<TTWatchItem*>(item)->m_Fetched;
         }
     }
     return 0;
 }
 
+bool WorkoutTreeModel::canFetchMore(const QModelIndex &parent) const
+{
+    TTWatchItem * watchItem = indexToWatchItem(parent);
+    return watchItem && watchItem->m_Fetched < watchItem->count();
+}
+
+void WorkoutTreeModel::fetchMore(const QModelIndex &parent)
+{
+    TTWatchItem * watchItem = indexToWatchItem(parent);
+    if ( watchItem )
+    {
+        fetchUpTo(watchItem, watchItem->m_Fetched + WORKOUT_PAGE_SIZE - 1);
+    }
+}
+
+void WorkoutTreeModel::fetchUpTo(TTWatchItem *watchItem, int row)
+{
+    int last = qMin(row, watchItem->count() - 1);
+    if ( last < watchItem->m_Fetched )
+    {
+        return;
+    }
+
+    beginInsertRows(findWatchItem(watchItem), watchItem->m_Fetched, last);
+    watchItem->m_Fetched = last + 1;
+    endInsertRows();
+}
+
+TTWatchItem *WorkoutTreeModel::indexToWatchItem(const QModelIndex &index) const
+{
+    if ( !index.isValid() )
+    {
+        return 0;
+    }
+
+    TTItem * item = (TTItem *)index.internalPointer();
+    if ( item->type() != TTItem::WatchItem )
+    {
+        return 0;
+    }
+    return static_cast<TTWatchItem*>(item);
+}
+
 int WorkoutTreeModel::columnCount(const QModelIndex &parent) const
 {
     Q_UNUSED(parent);
@@ -525,6 +1163,10 @@ QVariant WorkoutTreeModel::data(const QModelIndex &index, int role) const
     if ( index.isValid() )
     {
         TTItem * item = (TTItem *)index.internalPointer();
+        if ( item && item->type() == TTItem::WatchItem && role == Qt::ToolTipRole )
+        {
+            return aggregatesToolTip(static_cast<TTWatchItem*>(item)->name());
+        }
         if ( item )
         {
             return item->data(index.column(), role);
@@ -534,6 +1176,36 @@ QVariant WorkoutTreeModel::data(const QModelIndex &index, int role) const
     return QVariant();
 }
 
+QString WorkoutTreeModel::aggregatesToolTip(const QString &watch) const
+{
+    static const char * names[] = { "This week", "This month", "This year" };
+
+    Settings * settings = Settings::get();
+    QDate today = QDate::currentDate();
+    QStringList lines;
+    for ( int period = WorkoutAggregates::WEEK; period <= WorkoutAggregates::YEAR; period++ )
+    {
+        WorkoutAggregates::Totals t = m_Aggregates.totals((WorkoutAggregates::Period)period, today, WorkoutAggregates::ALL_SPORTS, watch);
+        QString distance = settings->useMetric() ?
+                    QString("%1 K").arg(QString::number(t.distance / 1000.0, 'f', 1)) :
+                    QString("%1 M").arg(QString::number(t.distance / 1609.34, 'f', 1));
+        lines << QString("%1: %2 workouts, %3, %4:%5 h, %6 kcal")
+                 .arg(names[period])
+                 .arg(t.count)
+                 .arg(distance)
+                 .arg(t.duration / 3600)
+                 .arg((t.duration / 60) % 60, 2, 10, QChar('0'))
+                 .arg(t.calories);
+    }
+
+    TrainingLoad::Day load = m_TrainingLoad.day(today);
+    lines << QString("Fitness %1, fatigue %2, form %3")
+             .arg(QString::number(load.ctl, 'f', 0))
+             .arg(QString::number(load.atl, 'f', 0))
+             .arg(QString::number(load.tsb, 'f', 0));
+    return lines.join("\n");
+}
+
 QVariant WorkoutTreeModel::headerData(int section, Qt::Orientation orientation, int role) const
 {
     if ( orientation == Qt::Horizontal && role == Qt::DisplayRole )
@@ -559,24 +1231,24 @@ QVariant WorkoutTreeModel::headerData(int section, Qt::Orientation orientation,
 
 QModelIndex WorkoutTreeModel::findWatchItem(TTWatchItem *item) const
 {
-    int index = m_WatchItems.indexOf(item);
-    return createIndex(index, 0, item);
+    return createIndex(item->row(), 0, item);
 }
 
-QModelIndex WorkoutTreeModel::findWorkoutItem(const QString &filename) const
+QModelIndex WorkoutTreeModel::findWorkoutItem(const QString &filename)
 {
-    TTWorkoutItem * item = getWorkoutItem(filename);
-    if ( !item )
+    TTWorkoutItem * item = getWorkoutItem(QDir::cleanPath(filename));
+    if ( !item || item->row() < 0 )
     {
-        return QModelIndex();
+        return QModelIndex(); // unknown or filtered out
     }
 
-    TTWatchItem * watch = (TTWatchItem*)item->parent();
-    int row = watch->children().indexOf( item );
-    return createIndex(row, 0, item);
+    // make sure the row is known to the views before handing out an index to it.
+    fetchUpTo(static_cast<TTWatchItem*>(item->parent()), item->row());
+
+    return createIndex(item->row(), 0, item);
 }
 
-TTItem *WorkoutTreeModel::indexToItem(QModelIndex &index)
+TTItem *WorkoutTreeModel::indexToItem(const QModelIndex &index)
 {
     if ( !index.isValid() )
     {
@@ -586,57 +1258,169 @@ TTItem *WorkoutTreeModel::indexToItem(QModelIndex &index)
     return (TTItem*)index.internalPointer();
 }
 
-TTWorkoutItem *WorkoutTreeModel::indexToWorkoutItem(QModelIndex &index)
+TTWorkoutItem *WorkoutTreeModel::indexToWorkoutItem(const QModelIndex &index)
 {
     if ( !index.isValid() )
     {
         return 0;
     }
 
-    TTWorkoutItem * item = (TTWorkoutItem *)index.internalPointer();
+    TTItem * item = (TTItem *)index.internalPointer();
     if ( item->type() != TTItem::WorkoutItem )
     {
         return 0;
     }
-    return item;
+    return static_cast<TTWorkoutItem*>(item);
 }
 
-bool WorkoutTreeModel::reloadIndex(QModelIndex &index)
+bool WorkoutTreeModel::reloadIndex(const QModelIndex &index)
 {
     if ( !index.isValid() )
     {
         return false;
     }
-    TTWorkoutItem * item = (TTWorkoutItem *)index.internalPointer();
-    if ( item->type() != TTItem::WorkoutItem )
+    TTWorkoutItem * item = indexToWorkoutItem(index);
+    if ( !item || !reloadWorkout(item) )
+    {
+        return false;
+    }
+
+    saveIndex();
+    return true;
+}
+
+bool WorkoutTreeModel::reloadWorkout(TTWorkoutItem *item)
+{
+    WorkoutSummary summary;
+    if ( !summary.read(item->filename()) )
     {
         return false;
     }
 
-    TTBinReader br;
-    ActivityPtr a = br.read(item->filename(), true, true);
-    if ( a )
+    double sortKey = item->sortKey(m_SortColumn);
+    bool shown = item->row() >= 0;
+
+    unindexWorkout(item);
+    aggregate(item, false);
+    item->set(summary);
+    item->saveIndex(m_LibraryIndex);
+    indexWorkout(item);
+    aggregate(item, true);
+
+    if ( m_Filter.matches(item) == shown && ( !m_DisplaySorted || item->sortKey(m_SortColumn) == sortKey ) )
     {
-        QTime t(0,0,0);
-        t = t.addSecs(a->duration());
-        item->set(a->date(), t, a->distance(),a->sport());
-        item->saveCache();
+        // stays in place
+        if ( shown && item->row() < static_cast<TTWatchItem*>(item->parent())->m_Fetched )
+        {
+            emit dataChanged(createIndex(item->row(), 0, item), createIndex(item->row(), columnCount(QModelIndex()) - 1, item));
+        }
     }
     else
     {
-        return false;
+        hideWorkout(item);
+        showWorkout(item);
     }
-    emit dataChanged(index,index);
     return true;
 }
 
-void WorkoutTreeModel::fileSystemChanged()
+void WorkoutTreeModel::fileSystemChanged(const QString &path)
 {
-    rescan(false);
+    m_ChangedDirs.insert(path);
+    m_RescanTimer.start();
+}
+
+void WorkoutTreeModel::rescanChangedDirectories()
+{
+    // a rescan of a parent may already have dropped a changed directory.
+    while ( !m_ChangedDirs.isEmpty() )
+    {
+        QString path = *m_ChangedDirs.begin();
+        m_ChangedDirs.erase(m_ChangedDirs.begin());
+        if ( m_Listings.contains(path) )
+        {
+            rescanDirectory(path);
+        }
+    }
+
+    saveIndex();
 }
 
+void WorkoutTreeModel::onDirectoriesScanned(const WorkoutDirListings &listings, int generation, bool last)
+{
+    if ( generation != m_ScanGeneration )
+    {
+        return;
+    }
+
+    QStringList misses;
+    foreach ( const WorkoutDirListing & listing, listings )
+    {
+        m_Listings.insert(listing.path, listing);
+        watchDirectory(listing.path);
+
+        QHash<QString, QPair<qint64, qint64> >::const_iterator it;
+        for ( it = listing.files.constBegin(); it != listing.files.constEnd(); ++it )
+        {
+            QString filename = listing.path + "/" + it.key();
+            if ( getWorkoutItem(filename) )
+            {
+                continue; // picked up by a rescan in the meantime.
+            }
+
+            TTWorkoutItem * item = createWorkout(filename);
+            if ( item == 0 )
+            {
+                continue;
+            }
+
+            if ( item->loadIndex(m_LibraryIndex) )
+            {
+                insertWorkout(item);
+            }
+            else
+            {
+                delete item;
+                misses << filename;
+            }
+        }
+    }
+
+    // workouts missing from the index are parsed on the pool, a few per task.
+    for ( int i = 0; i < misses.count(); i += SUMMARY_BATCH_SIZE )
+    {
+        m_ScanTasks++;
+        m_ScanPool.start(new WorkoutSummaryReader(this, misses.mid(i, SUMMARY_BATCH_SIZE), generation, m_CancelScan));
+    }
 
+    if ( last )
+    {
+        scanTaskDone();
+    }
+}
 
+void WorkoutTreeModel::onSummariesRead(const WorkoutSummaries &summaries, int generation)
+{
+    if ( generation != m_ScanGeneration )
+    {
+        return;
+    }
 
+    foreach ( const WorkoutSummary & summary, summaries )
+    {
+        if ( !summary.valid || getWorkoutItem(summary.filename) )
+        {
+            continue;
+        }
 
+        TTWorkoutItem * item = createWorkout(summary.filename);
+        if ( item == 0 )
+        {
+            continue;
+        }
+        item->set(summary);
+        item->saveIndex(m_LibraryIndex);
+        insertWorkout(item);
+    }
 
+    scanTaskDone();
+}
@@ -2,102 +2,229 @@
 #define WORKOUTTREEMODEL_H
 
 #include <QFileSystemWatcher>
+#include <QTimer>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QSet>
 #include <QAbstractItemModel>
 #include <QObject>
 #include <QList>
+#include <QVector>
+#include <QHash>
 #include <QDateTime>
 #include <QTime>
 #include "activity.h"
+#include "libraryindex.h"
+#include "workoutscanner.h"
+#include "workoutaggregates.h"
+#include "trainingload.h"
 
-class TTItem : public QObject {
-    Q_OBJECT
-
+class TTItem {
 public:
-    TTItem(QObject * parent = 0) : QObject(parent) {}
+    enum Type { WatchItem, WorkoutItem };
+
+    TTItem(TTItem * parent = 0) : m_Parent(parent), m_Row(-1) {}
     virtual ~TTItem() {}
 
     virtual QVariant data(int column, int role) const = 0;
-    enum Type { WatchItem, WorkoutItem };
     virtual Type type() const = 0;
+
+    TTItem * parent() const { return m_Parent; }
+    int row() const { return m_Row; }
+
+protected:
+    TTItem * m_Parent;
+    int m_Row; // position within the parent, kept up to date by WorkoutTreeModel
+
+    friend class WorkoutTreeModel;
 };
 
-class TTWatchItem : public TTItem {
+class TTWorkoutItem;
 
-    Q_OBJECT
+class TTWatchItem : public TTItem {
     QString m_Name;
+    QVector<TTWorkoutItem*> m_Workouts;
+    int m_Fetched; // rows exposed to the views so far, see WorkoutTreeModel::fetchMore
 public:
-    TTWatchItem( const QString & name, QObject * parent = 0 );
+    TTWatchItem( const QString & name );
     QVariant data(int column, int role) const;
     Type type() const { return WatchItem; }
     bool match ( const QString & name );
+    QString name() const;
+    int count() const;
+    TTWorkoutItem * at( int row ) const;
+
+    friend class WorkoutTreeModel;
 };
 
 class TTWorkoutItem : public TTItem {
-    Q_OBJECT
+public:
+    // keys the model keeps sorted indexes on, these match the columns.
+    enum SortKey { SORT_DATE, SORT_DURATION, SORT_DISTANCE, SORT_PACE, SORT_SPORT, SORT_KEY_COUNT };
+
+private:
     QString m_Name;
     QString m_Filename;
     QDateTime m_StartTime;
     QTime m_Duration;
     int m_Distance;
+    int m_Calories;
+    float m_Trimp;
     Activity::Sport m_Sport;
     bool m_Tag;
+    double m_SortKeys[SORT_KEY_COUNT];
     QString formatDistance() const;
     QString formatPace() const;
 public:
-    TTWorkoutItem( const QString & name, const QString & filename, TTWatchItem * parent );
+    TTWorkoutItem( const QString & name, const QString & filename, TTWatchItem * parent = 0 );
     QVariant data(int column, int role) const;
     Type type() const { return WorkoutItem; }
     bool match ( const QString & filename );
     void set( QDateTime startTime, QTime duration, int distance, Activity::Sport sport );
-    bool saveCache();
-    bool loadCache();
+    void set( const WorkoutSummary & summary );
+    bool loadIndex( LibraryIndex & index );
+    void saveIndex( LibraryIndex & index ) const;
     QString filename() const;
     bool tag() const;
     void setTag( bool tag);
     Activity::Sport sport() const;
+    QDateTime startTime() const;
+    int distance() const;
+    int calories() const;
+    void setCalories( int calories );
+    float trimp() const;
+    QTime duration() const;
+    double sortKey( int key ) const { return m_SortKeys[key]; }
+    static double dateKey( const QDateTime & dateTime );
 
 };
 
+// Range filter on the workout library, unset bounds do not filter.
+struct WorkoutFilter
+{
+    QDateTime from;
+    QDateTime to;
+    QSet<int> sports;   // Activity::Sport values, empty for all sports
+    int minDistance;    // meters, -1 for no bound
+    int maxDistance;
+
+    WorkoutFilter() : minDistance(-1), maxDistance(-1) {}
+    bool isEmpty() const;
+    bool matches( const TTWorkoutItem * item ) const;
+};
+
 
 class WorkoutTreeModel : public QAbstractItemModel
 {
     Q_OBJECT
     QString m_TTDir;
-    typedef QList<TTWatchItem*> WatchItems;
+    typedef QVector<TTWatchItem*> WatchItems;
     WatchItems m_WatchItems;
+    QHash<QString, TTWorkoutItem*> m_WorkoutIndex; // filename -> item
+    LibraryIndex m_LibraryIndex;
     QFileSystemWatcher m_FileSystemWatcher;
 
-    TTWatchItem * getWatchItem(const QString & name , bool *newlyCreated = 0);
+    // last known contents of every directory in the library, used to diff
+    // a directory when the file system watcher reports a change.
+    QHash<QString, WorkoutDirListing> m_Listings;
+    QSet<QString> m_WatchedDirs;
+    QSet<QString> m_ChangedDirs;
+    QTimer m_RescanTimer;
+
+    QThreadPool m_ScanPool;
+    QAtomicInt m_CancelScan;
+    int m_ScanGeneration;
+    int m_ScanTasks; // directory walk and summary reads still underway
+
+    // library wide indexes sorted on each TTWorkoutItem::SortKey, only left
+    // unsorted while a scan appends to them.
+    mutable QVector<TTWorkoutItem*> m_SortIndexes[TTWorkoutItem::SORT_KEY_COUNT];
+    mutable bool m_SortIndexesValid;
+    int m_SortColumn;
+    Qt::SortOrder m_SortOrder;
+    bool m_DisplaySorted; // the rows of every watch follow m_SortColumn/m_SortOrder
+    WorkoutFilter m_Filter;
+
+    // totals of the library as last saved, kept up to date as workouts come
+    // and go. A full scan builds its totals in m_ScanAggregates and swaps them
+    // in when done, so the UI never sees the totals of a half scanned library.
+    WorkoutAggregates m_Aggregates;
+    WorkoutAggregates m_ScanAggregates;
+    TrainingLoad m_TrainingLoad;
+    TrainingLoad m_ScanTrainingLoad;
+
+    TTWatchItem * getWatchItem(const QString & name );
     TTWorkoutItem *getWorkoutItem( const QString & filename ) const;
 
     void clearTags();
     void deleteUntagged();
-    void process(const QString & filename , bool full);
+    void removeWorkout( const QString & filename );
+    void removeWorkout( TTWorkoutItem * item );
+    bool reloadWorkout( TTWorkoutItem * item );
+    bool splitFilename( const QString & filename, QString & watchName, QString & name ) const;
+    TTWorkoutItem * createWorkout( const QString & filename ) const;
+    void insertWorkout( TTWorkoutItem * item );
+    void process(const QString & filename );
+    void rescanDirectory( const QString & path );
+    void forgetDirectory( const QString & path );
+    void watchDirectory( const QString & path );
+    void startScan();
+    void scanTaskDone();
+    void saveIndex();
+    void fetchUpTo( TTWatchItem * watchItem, int row );
+    TTWatchItem * indexToWatchItem( const QModelIndex & index ) const;
+    void indexWorkout( TTWorkoutItem * item );
+    void unindexWorkout( TTWorkoutItem * item );
+    void ensureSortIndexes() const;
+    void showWorkout( TTWorkoutItem * item );
+    void hideWorkout( TTWorkoutItem * item );
+    void renumber( TTWatchItem * watchItem, int from );
+    void layoutRows();
+    void sortDisplay();
+    void aggregate( const TTWorkoutItem * item, bool add );
+    QString aggregatesFilename() const;
+    QString aggregatesToolTip( const QString & watch ) const;
 
 public:
     explicit WorkoutTreeModel(const QString & ttDir, QObject *parent = 0);
     virtual ~WorkoutTreeModel();
     void rescan(bool full);
+    void refresh( const QStringList & filenames );
+    bool isScanning() const;
     void clear();
     QModelIndex index(int row, int column, const QModelIndex &parent) const;
     QModelIndex parent(const QModelIndex &child) const;
     int rowCount(const QModelIndex &parent) const;
     int columnCount(const QModelIndex &parent) const;
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
     QVariant data(const QModelIndex &index, int role) const;
     QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder);
+
+    void setFilter( const WorkoutFilter & filter );
+    WorkoutFilter filter() const;
+    const WorkoutAggregates & aggregates() const;
+    const TrainingLoad & trainingLoad() const;
+    QVector<TTWorkoutItem*> query( const WorkoutFilter & filter, int sortKey = TTWorkoutItem::SORT_DATE, Qt::SortOrder order = Qt::AscendingOrder ) const;
 
     QModelIndex findWatchItem ( TTWatchItem * item ) const;
-    QModelIndex findWorkoutItem( const QString & filename ) const;
-    static TTItem * indexToItem( QModelIndex & index );
-    static TTWorkoutItem * indexToWorkoutItem( QModelIndex & index );
+    QModelIndex findWorkoutItem( const QString & filename );
+    static TTItem * indexToItem( const QModelIndex & index );
+    static TTWorkoutItem * indexToWorkoutItem( const QModelIndex & index );
 
-    bool reloadIndex( QModelIndex & index );
+    bool reloadIndex( const QModelIndex & index );
 
 signals:
+    void scanFinished();
+    void aggregatesChanged(); // totals or training load changed
 
 public slots:
 private slots:
-    void fileSystemChanged();
+    void fileSystemChanged( const QString & path );
+    void rescanChangedDirectories();
+    void onDirectoriesScanned( const WorkoutDirListings & listings, int generation, bool last );
+    void onSummariesRead( const WorkoutSummaries & summaries, int generation );
 
 };
 